@@ -0,0 +1,402 @@
+// Benchmarks of rtdsync primitives.
+// Every benchmark reports the throughput in ops/sec, and the p50/p99/p999 latency in nanoseconds.
+// For queues, the latency is the handoff latency from a push to the pop of the same element.
+//
+// Usage: rtdsync_bench [--filter <substring>] [--ops <n>] [--json]
+//   --filter  run the benchmarks whose name contains the substring
+//   --ops     the number of operations of each run, 200000 by default
+//   --json    print the results as a JSON array instead of a table
+
+#include <rtd/chan.h>
+#include <rtd/ringbuf.h>
+#include <rtd/broadcast.h>
+#include <rtd/time.h>
+#include <rtd/waitgroup.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+int64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+// An element of `Size` bytes, stamped with the time it was pushed.
+// The stamp alone is the smallest payload, a padding byte would make it 16 bytes.
+template <size_t Size>
+struct Payload {
+    static_assert(Size > sizeof(int64_t) && Size % sizeof(int64_t) == 0, "payload must be a multiple of 8 bytes");
+    int64_t stamp;
+    char data[Size - sizeof(int64_t)];
+};
+
+template <>
+struct Payload<sizeof(int64_t)> {
+    int64_t stamp;
+};
+
+struct Result {
+    std::string name;
+    std::vector<std::pair<std::string, long>> params;
+    long ops;
+    double seconds;
+    int64_t p50;
+    int64_t p99;
+    int64_t p999;
+};
+
+// Latency samples of one thread, merged after a run.
+typedef std::vector<int64_t> Samples;
+
+Result MakeResult(const std::string& name, std::vector<std::pair<std::string, long>> params,
+                  long ops, int64_t elapsed, std::vector<Samples>& samples) {
+    Samples all;
+    for(Samples& s : samples) {
+        all.insert(all.end(), s.begin(), s.end());
+    }
+    std::sort(all.begin(), all.end());
+    auto at = [&](double q) -> int64_t {
+        if(all.empty()) {
+            return 0;
+        }
+        size_t i = static_cast<size_t>(q * all.size());
+        return all[i < all.size() ? i : all.size() - 1];
+    };
+    Result r;
+    r.name = name;
+    r.params = params;
+    r.ops = ops;
+    r.seconds = elapsed / 1e9;
+    r.p50 = at(0.50);
+    r.p99 = at(0.99);
+    r.p999 = at(0.999);
+    return r;
+}
+
+void Join(std::vector<std::thread>& ts) {
+    for(std::thread& t : ts) {
+        t.join();
+    }
+}
+
+// `producers` push into one channel of capacity `buffer`, and `consumers` pop from it.
+template <size_t Size>
+Result BenchChan(int producers, int consumers, int buffer, long ops) {
+    auto ch = rtd::MakeChan<Payload<Size>>(buffer);
+    std::vector<Samples> samples(consumers);
+    std::vector<std::thread> ts;
+    int64_t start = NowNs();
+    for(int i = 0; i < consumers; i++) {
+        ts.emplace_back([&, i]() {
+            Payload<Size> p;
+            samples[i].reserve(ops / consumers + 1);
+            while(ch->Pop(&p)) {
+                samples[i].push_back(NowNs() - p.stamp);
+            }
+        });
+    }
+    std::vector<std::thread> ps;
+    for(int i = 0; i < producers; i++) {
+        ps.emplace_back([&]() {
+            Payload<Size> p;
+            for(long j = 0; j < ops / producers; j++) {
+                p.stamp = NowNs();
+                ch->Push(p);
+            }
+        });
+    }
+    Join(ps);
+    ch->Close();
+    Join(ts);
+    return MakeResult("chan", {{"producers", producers}, {"consumers", consumers}, {"buffer", buffer}, {"payload", static_cast<long>(sizeof(Payload<Size>))}},
+                      ops / producers * producers, NowNs() - start, samples);
+}
+
+// Two producers push into their own channels, and one consumer selects from both,
+// polling TryStates, or parked on the channels by their cases if `parking`.
+template <size_t Size>
+Result BenchSelect(int buffer, bool parking, long ops) {
+    auto ch1 = rtd::MakeChan<Payload<Size>>(buffer);
+    auto ch2 = rtd::MakeChan<Payload<Size>>(buffer);
+    std::vector<Samples> samples(1);
+    samples[0].reserve(ops);
+    int64_t start = NowNs();
+    std::vector<std::thread> ps;
+    for(auto ch : {ch1, ch2}) {
+        ps.emplace_back([ch, ops]() {
+            Payload<Size> p;
+            for(long j = 0; j < ops / 2; j++) {
+                p.stamp = NowNs();
+                ch->Push(p);
+            }
+            ch->Close();
+        });
+    }
+    Payload<Size> p;
+    if(parking) {
+        while(rtd::Select({ch1->PopCase(&p), ch2->PopCase(&p)}) >= 0) {
+            samples[0].push_back(NowNs() - p.stamp);
+        }
+    } else {
+        while(rtd::Select({ch1->TryPopState(&p), ch2->TryPopState(&p)}) >= 0) {
+            samples[0].push_back(NowNs() - p.stamp);
+        }
+    }
+    Join(ps);
+    return MakeResult("select", {{"channels", 2}, {"parking", parking}, {"buffer", buffer},
+                                 {"payload", static_cast<long>(sizeof(Payload<Size>))}},
+                      ops / 2 * 2, NowNs() - start, samples);
+}
+
+// `producers` put into a RingBuffer of `size`, and `consumers` get from it.
+template <size_t Size>
+Result BenchRingBuffer(int producers, int consumers, int size, long ops) {
+    rtd::RingBuffer<Payload<Size>> rb(size);
+    long each = ops / producers / consumers * consumers;     // the total is divisible by consumers
+    long total = each * producers;
+    std::vector<Samples> samples(consumers);
+    std::vector<std::thread> ts;
+    int64_t start = NowNs();
+    for(int i = 0; i < consumers; i++) {
+        ts.emplace_back([&, i]() {
+            Payload<Size> p;
+            samples[i].reserve(total / consumers);
+            for(long j = 0; j < total / consumers; j++) {
+                rb.Get(&p);
+                samples[i].push_back(NowNs() - p.stamp);
+            }
+        });
+    }
+    for(int i = 0; i < producers; i++) {
+        ts.emplace_back([&]() {
+            Payload<Size> p;
+            for(long j = 0; j < each; j++) {
+                p.stamp = NowNs();
+                rb.Put(p);
+            }
+        });
+    }
+    Join(ts);
+    return MakeResult("ringbuf", {{"producers", producers}, {"consumers", consumers}, {"buffer", size}, {"payload", static_cast<long>(sizeof(Payload<Size>))}},
+                      total, NowNs() - start, samples);
+}
+
+// One publisher fans out to `subscribers`, every one of them receives every element.
+template <size_t Size>
+Result BenchBroadcast(int subscribers, int buffer, long ops) {
+    auto b = rtd::MakeBroadcast<Payload<Size>>(buffer);
+    std::vector<Samples> samples(subscribers);
+    std::vector<std::thread> ts;
+    for(int i = 0; i < subscribers; i++) {
+        auto s = b->Subscribe();
+        ts.emplace_back([&samples, s, i, ops]() {
+            Payload<Size> p;
+            samples[i].reserve(ops);
+            while(s->Recv(&p)) {
+                samples[i].push_back(NowNs() - p.stamp);
+            }
+        });
+    }
+    int64_t start = NowNs();
+    Payload<Size> p;
+    for(long j = 0; j < ops; j++) {
+        p.stamp = NowNs();
+        b->Publish(p);
+    }
+    b->Close();
+    Join(ts);
+    return MakeResult("broadcast", {{"subscribers", subscribers}, {"buffer", buffer}, {"payload", static_cast<long>(sizeof(Payload<Size>))}},
+                      ops, NowNs() - start, samples);
+}
+
+// `threads` start timers of `delayUs` one after another and wait for them.
+// The latency is how late a timer is delivered after its deadline.
+Result BenchTimer(int threads, int delayUs, long ops) {
+    std::vector<Samples> samples(threads);
+    std::vector<std::thread> ts;
+    long each = ops / threads;
+    int64_t start = NowNs();
+    for(int i = 0; i < threads; i++) {
+        ts.emplace_back([&, i]() {
+            samples[i].reserve(each);
+            for(long j = 0; j < each; j++) {
+                int64_t deadline = NowNs() + delayUs * 1000;
+                rtd::time::Timer<long, std::micro> t{std::chrono::microseconds(delayUs)};
+                t.Start();
+                t.Channel()->Pop(nullptr);
+                samples[i].push_back(NowNs() - deadline);
+            }
+        });
+    }
+    Join(ts);
+    return MakeResult("timer", {{"threads", threads}, {"delay_us", delayUs}},
+                      each * threads, NowNs() - start, samples);
+}
+
+// Every round adds `workers` to a WaitGroup, wakes the workers, and waits for all of their Done().
+// The latency is the round trip of a round.
+Result BenchWaitGroup(int workers, long ops) {
+    auto wg = rtd::MakeWaitGroup();
+    std::vector<rtd::SharedChan<int>> gos;
+    std::vector<std::thread> ts;
+    for(int i = 0; i < workers; i++) {
+        auto go = rtd::MakeChan<int>(1);
+        gos.push_back(go);
+        ts.emplace_back([wg, go]() {
+            while(go->Pop(nullptr)) {
+                wg->Done();
+            }
+        });
+    }
+    std::vector<Samples> samples(1);
+    long rounds = ops / workers;
+    samples[0].reserve(rounds);
+    int64_t start = NowNs();
+    for(long j = 0; j < rounds; j++) {
+        int64_t begin = NowNs();
+        wg->Add(workers);
+        for(auto& go : gos) {
+            go->Push(1);
+        }
+        wg->Wait();
+        samples[0].push_back(NowNs() - begin);
+    }
+    int64_t elapsed = NowNs() - start;
+    for(auto& go : gos) {
+        go->Close();
+    }
+    Join(ts);
+    return MakeResult("waitgroup", {{"workers", workers}}, rounds * workers, elapsed, samples);
+}
+
+template <template <size_t> class F, typename... Args>
+Result ByPayload(int payload, Args... args) {
+    switch(payload) {
+        case 8:
+            return F<8>::Run(args...);
+        case 64:
+            return F<64>::Run(args...);
+        default:
+            return F<512>::Run(args...);
+    }
+}
+
+template <size_t Size>
+struct ChanRun {
+    static Result Run(int p, int c, int buffer, long ops) { return BenchChan<Size>(p, c, buffer, ops); }
+};
+
+template <size_t Size>
+struct SelectRun {
+    static Result Run(int buffer, bool parking, long ops) { return BenchSelect<Size>(buffer, parking, ops); }
+};
+
+template <size_t Size>
+struct RingBufferRun {
+    static Result Run(int p, int c, int buffer, long ops) { return BenchRingBuffer<Size>(p, c, buffer, ops); }
+};
+
+template <size_t Size>
+struct BroadcastRun {
+    static Result Run(int subscribers, int buffer, long ops) { return BenchBroadcast<Size>(subscribers, buffer, ops); }
+};
+
+void Print(const Result& r, bool json, bool first) {
+    if(json) {
+        std::printf("%s\n  {\"name\": \"%s\", \"params\": {", first ? "" : ",", r.name.c_str());
+        for(size_t i = 0; i < r.params.size(); i++) {
+            std::printf("%s\"%s\": %ld", i == 0 ? "" : ", ", r.params[i].first.c_str(), r.params[i].second);
+        }
+        std::printf("}, \"ops\": %ld, \"seconds\": %.6f, \"ops_per_sec\": %.1f, "
+                    "\"p50_ns\": %lld, \"p99_ns\": %lld, \"p999_ns\": %lld}",
+                    r.ops, r.seconds, r.ops / r.seconds,
+                    (long long)r.p50, (long long)r.p99, (long long)r.p999);
+        return;
+    }
+    std::string params;
+    for(size_t i = 0; i < r.params.size(); i++) {
+        params += (i == 0 ? "" : " ") + r.params[i].first + "=" + std::to_string(r.params[i].second);
+    }
+    std::printf("%-10s %-48s %12.0f ops/s  p50 %8lld ns  p99 %9lld ns  p999 %9lld ns\n",
+                r.name.c_str(), params.c_str(), r.ops / r.seconds,
+                (long long)r.p50, (long long)r.p99, (long long)r.p999);
+    std::fflush(stdout);
+}
+
+}
+
+int main(int argc, char** argv) {
+    std::string filter;
+    long ops = 200000;
+    bool json = false;
+    for(int i = 1; i < argc; i++) {
+        if(std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if(std::strcmp(argv[i], "--ops") == 0 && i + 1 < argc) {
+            ops = std::atol(argv[++i]);
+        } else if(std::strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else {
+            std::fprintf(stderr, "usage: %s [--filter <substring>] [--ops <n>] [--json]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    bool first = true;
+    auto run = [&](const std::string& name, std::function<Result()> f) {
+        if(!filter.empty() && name.find(filter) == std::string::npos) {
+            return;
+        }
+        Print(f(), json, first);
+        first = false;
+    };
+
+    if(json) {
+        std::printf("[");
+    }
+    const int threads[][2] = {{1, 1}, {4, 1}, {1, 4}, {4, 4}};
+    for(int payload : {8, 64, 512}) {
+        for(auto& pc : threads) {
+            for(int buffer : {1, 64, 1024}) {
+                run("chan", [=]() { return ByPayload<ChanRun>(payload, pc[0], pc[1], buffer, ops); });
+            }
+        }
+        for(int buffer : {1, 1024}) {
+            for(bool parking : {false, true}) {
+                run("select", [=]() { return ByPayload<SelectRun>(payload, buffer, parking, ops); });
+            }
+        }
+        for(auto& pc : threads) {
+            for(int buffer : {64, 1024}) {
+                run("ringbuf", [=]() { return ByPayload<RingBufferRun>(payload, pc[0], pc[1], buffer, ops); });
+            }
+        }
+        for(int subscribers : {1, 4}) {
+            for(int buffer : {64, 1024}) {
+                run("broadcast", [=]() { return ByPayload<BroadcastRun>(payload, subscribers, buffer, ops); });
+            }
+        }
+    }
+    for(int n : {1, 8}) {
+        run("timer", [=]() { return BenchTimer(n, 100, ops / 100); });
+    }
+    for(int n : {1, 4}) {
+        run("waitgroup", [=]() { return BenchWaitGroup(n, ops / 10); });
+    }
+    if(json) {
+        std::printf("\n]\n");
+    }
+    return 0;
+}
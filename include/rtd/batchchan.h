@@ -0,0 +1,157 @@
+#ifndef RTDSYNC_BATCHCHAN_H
+#define RTDSYNC_BATCHCHAN_H
+
+#include "time.h"
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+namespace rtd {
+
+// A BatchChan groups elements into batches for consumers that amortize their work, like database writes.
+// PopBatch() returns as soon as a batch reaches its size, or when the first element of a batch
+// has waited for the linger duration, whichever comes first.
+// The linger deadline is a timer of the timers heap, so nobody polls.
+// The buffers are swapped between the producers and the consumer, so they are reused across batches.
+template <typename T>
+class BatchChan : public std::enable_shared_from_this<BatchChan<T>> {
+    typedef std::unique_lock<std::mutex> lock;
+
+protected:
+    // You cannot create a batch channel by constructor.
+    // Using `MakeBatchChan()` to create a shared_ptr.
+    BatchChan(int size, time::nanoseconds linger) : size_(size < 1 ? 1 : size), linger_(linger),
+            closed_(false), expired_(false) {
+        pending_.reserve(size_);
+    }
+
+public:
+    template <typename U, typename R, typename P>
+    friend std::shared_ptr<BatchChan<U>> MakeBatchChan(int size, std::chrono::duration<R, P> linger);
+
+    BatchChan(const BatchChan&) = delete;
+    BatchChan& operator=(const BatchChan&) = delete;
+
+    // Push an element into the pending batch.
+    // Blocking when a full batch has not been taken.
+    // Return 1 if success, return 0 if closed.
+    int Push(const T& v) {
+        time::_SharedTimer t;
+        {
+            lock lc(mu_);
+            cv_.wait(lc, [&]() { return closed_ || pending_.size() < size_; });
+            if(closed_) {
+                return 0;
+            }
+            pending_.push_back(v);
+            if(pending_.size() == size_) {
+                cv_.notify_all();
+            } else if(pending_.size() == 1) {
+                t = _Arm();
+            }
+        }
+        if(t != nullptr) {
+            time::_AddTimer(t);     // not with `mu_` locked, the timer locks it under the heap lock
+        }
+        return 1;
+    }
+
+    // Take a batch into `out`, whose previous content is cleared and whose buffer is reused.
+    // Blocking until a batch is full, lingers long enough, or the channel is closed.
+    // Return 1 if success, return 0 if closed and empty.
+    int PopBatch(std::vector<T>* out) {
+        out->clear();
+        time::_SharedTimer t;
+        {
+            lock lc(mu_);
+            cv_.wait(lc, [&]() { return closed_ || pending_.size() >= size_ || (expired_ && !pending_.empty()); });
+            if(pending_.empty()) {
+                return 0;
+            }
+            out->swap(pending_);
+            expired_ = false;
+            t.swap(timer_);     // the linger timer of a full batch has not fired
+            cv_.notify_all();
+        }
+        if(t != nullptr) {
+            _Disarm(t);
+        }
+        return 1;
+    }
+
+    // Close the channel, and it cannot Push any more.
+    // The pending elements are still taken by PopBatch() at once.
+    void Close() {
+        lock lc(mu_);
+        closed_ = true;
+        cv_.notify_all();
+    }
+
+    bool IsClosed() {
+        lock lc(mu_);
+        return closed_;
+    }
+
+private:
+    // Create the linger timer of a new batch, with `mu_` locked.
+    time::_SharedTimer _Arm() {
+        time::_SharedTimer t = time::_NewTimer();
+        t->when = time::MonoNow() + linger_;
+        t->arg = this->shared_from_this();
+        t->Do = &BatchChan::_Expire;
+        timer_ = t;
+        return t;
+    }
+
+    // Stop the linger timer of a batch taken before it fired, not with `mu_` locked,
+    // since a running timer locks it and _StopTimer() waits for the timer to finish.
+    // A stopped timer is not run any more, so it drops its reference to the channel at once,
+    // instead of keeping it alive until the poller pops it.
+    static void _Disarm(const time::_SharedTimer& t) {
+        if(time::_StopTimer(t)) {
+            t->arg.reset();
+        }
+    }
+
+    static void _Expire(time::_Timer* t, int64_t) {
+        BatchChan* c = static_cast<BatchChan*>(t->arg.get());
+        lock lc(c->mu_);
+        if(c->timer_.get() == t) {  // the batch it was armed for is still pending
+            c->expired_ = true;
+            c->timer_.reset();  // the timer owns the channel until it fires, do not keep a cycle
+            c->cv_.notify_all();
+        }
+    }
+
+    size_t size_;
+
+    time::nanoseconds linger_;
+
+    std::mutex mu_;
+
+    std::condition_variable cv_;
+
+    std::vector<T> pending_;
+
+    bool closed_;
+
+    // Whether the linger timer of the pending batch has fired.
+    bool expired_;
+
+    // The linger timer of the pending batch, until it fires.
+    time::_SharedTimer timer_;
+};
+
+template <typename T>
+using SharedBatchChan = std::shared_ptr<BatchChan<T>>;
+
+// Make a batch channel flushing every `size` elements, or `linger` after the first element of a batch.
+template <typename T, typename R, typename P>
+std::shared_ptr<BatchChan<T>> MakeBatchChan(int size, std::chrono::duration<R, P> linger) {
+    return std::shared_ptr<BatchChan<T>>(new BatchChan<T>(size, std::chrono::duration_cast<time::nanoseconds>(linger)));
+}
+
+}
+
+#endif //RTDSYNC_BATCHCHAN_H
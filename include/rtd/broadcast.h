@@ -0,0 +1,393 @@
+#ifndef RTDSYNC_BROADCAST_H
+#define RTDSYNC_BROADCAST_H
+
+#include "chan.h"
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <cstddef>
+#include <cstdint>
+
+namespace rtd {
+
+// What a broadcast does when its slowest subscriber is a full ring behind.
+enum class BroadcastPolicy {
+    // The publisher blocks until the slowest subscriber moves on.
+    block,
+
+    // The publisher overwrites the oldest element, and a subscriber that falls behind
+    // skips to the oldest element available and counts the skipped ones in Dropped().
+    lag
+};
+
+template <typename T>
+class Broadcast;
+
+// A slot of the ring.
+// `seq` is the sequence of the element in the slot plus one, like `_node::pos` of RingBuffer,
+// so a reader knows whether the slot holds the element it expects, an older or a newer one.
+template <typename T>
+struct _BroadcastSlot {
+    std::atomic<size_t> seq;
+
+    // Readers and writer lock of the slot in `BroadcastPolicy::lag`,
+    // -1 if it is being written, or the number of readers.
+    std::atomic<int> rw;
+
+    T data;
+};
+
+// A subscriber of a broadcast, with its own cursor into the ring.
+// It receives every element published after it subscribes, unless it lags behind.
+template <typename T>
+class Subscriber {
+public:
+    friend class Broadcast<T>;
+
+    Subscriber(const Subscriber&) = delete;
+    Subscriber& operator=(const Subscriber&) = delete;
+
+    ~Subscriber() {
+        b_->_Unsubscribe(this);
+    }
+
+    // Receive an element.
+    // Blocking when there is no new element.
+    // Return 1 if success, return 0 if closed and all elements have been received.
+    int Recv(T* v) {
+        for(int spins = 0;; spins++) {
+            int res = TryRecv(v);
+            if(res != 0) {
+                return res == 1 ? 1 : 0;
+            }
+            if(spins < 64) {
+                std::this_thread::yield();
+                continue;
+            }
+            b_->_WaitPublished(cursor_.load());
+        }
+    }
+
+    // Receive an element in non-blocking.
+    // Return 1 if success, return 0 if no new element, return -1 if closed and all elements have been received.
+    int TryRecv(T* v) {
+        return b_->_TryRecv(this, v);
+    }
+
+    TryState TryRecvState(T* v) {
+        return [=]() -> int {
+            return TryRecv(v);
+        };
+    }
+
+    // Return the number of elements skipped for lagging behind.
+    uint64_t Dropped() {
+        return dropped_;
+    }
+
+    // Return the number of elements published but not received yet.
+    size_t Lag() {
+        return b_->claim_.load() - cursor_.load();
+    }
+
+private:
+    explicit Subscriber(const std::shared_ptr<Broadcast<T>>& b) : b_(b), dropped_(0) {}
+
+    std::shared_ptr<Broadcast<T>> b_;
+
+    // The sequence of the next element to receive.
+    std::atomic<size_t> cursor_;
+
+    std::atomic<uint64_t> dropped_;
+};
+
+template <typename T>
+using SharedSubscriber = std::shared_ptr<Subscriber<T>>;
+
+// A broadcast channel fans out one stream to many subscribers, in the style of the Disruptor.
+// An element is written once into a ring, and every subscriber reads it by its own cursor,
+// so publishing does not copy an element per subscriber.
+// The ring is bounded, and the slowest subscriber applies backpressure or lags behind by `BroadcastPolicy`.
+template <typename T>
+class Broadcast : public std::enable_shared_from_this<Broadcast<T>> {
+    typedef std::unique_lock<std::mutex> lock;
+
+protected:
+    // You cannot create a broadcast by constructor.
+    // Using `MakeBroadcast()` to create a shared_ptr.
+    Broadcast(size_t size, BroadcastPolicy policy) : policy_(policy), closed_(false),
+            claim_(0), gate_(0), readersWaiting_(0), writersWaiting_(0) {
+        cap_ = 1;
+        while(cap_ < size) {
+            cap_ <<= 1;
+        }
+        mask_ = cap_ - 1;
+        buf_ = new _BroadcastSlot<T>[cap_];
+        for(size_t i = 0; i < cap_; i++) {
+            buf_[i].seq = i + 1 - cap_;     // as if the previous lap has been published
+            buf_[i].rw = 0;
+        }
+    }
+
+public:
+    friend class Subscriber<T>;
+
+    template <typename U>
+    friend std::shared_ptr<Broadcast<U>> MakeBroadcast(size_t size);
+
+    template <typename U>
+    friend std::shared_ptr<Broadcast<U>> MakeBroadcast(size_t size, BroadcastPolicy policy);
+
+    Broadcast(const Broadcast&) = delete;
+    Broadcast& operator=(const Broadcast&) = delete;
+
+    ~Broadcast() {
+        delete [] buf_;
+    }
+
+    // Subscribe to the elements published from now on.
+    SharedSubscriber<T> Subscribe() {
+        SharedSubscriber<T> s(new Subscriber<T>(this->shared_from_this()));
+        lock lc(mu_);
+        s->cursor_ = claim_.load();
+        subs_.push_back(s.get());
+        return s;
+    }
+
+    // Publish an element to all subscribers.
+    // Blocking when the slowest subscriber is a full ring behind in `BroadcastPolicy::block`.
+    // Return 1 if success, return 0 if closed.
+    int Publish(const T& v) {
+        for(;;) {
+            int res = TryPublish(v);
+            if(res != 0) {
+                return res == 1 ? 1 : 0;
+            }
+            _WaitGate();
+        }
+    }
+
+    // Publish an element in non-blocking.
+    // Return 1 if success, return 0 if filled, return -1 if closed.
+    // It never returns 0 in `BroadcastPolicy::lag`.
+    int TryPublish(const T& v) {
+        size_t pos = claim_.load();
+        for(;;) {
+            if(closed_) {
+                return -1;
+            }
+            if(policy_ == BroadcastPolicy::block && pos >= cap_ && pos - cap_ >= gate_.load()) {
+                gate_ = _MinCursor();
+                if(pos - cap_ >= gate_.load()) {
+                    return 0;
+                }
+            }
+            if(claim_.compare_exchange_weak(pos, pos + 1)) {
+                break;
+            }
+        }
+
+        _BroadcastSlot<T>& n = buf_[pos & mask_];
+        while(n.seq.load() != pos + 1 - cap_) {     // the writer of the previous lap is still writing
+            std::this_thread::yield();
+        }
+        if(policy_ == BroadcastPolicy::lag) {
+            int expected = 0;
+            while(!n.rw.compare_exchange_weak(expected, -1)) {
+                expected = 0;
+                std::this_thread::yield();
+            }
+            n.data = v;
+            n.seq = pos + 1;
+            n.rw = 0;
+        } else {
+            n.data = v;
+            n.seq = pos + 1;
+        }
+
+        if(readersWaiting_.load() > 0) {
+            lock lc(mu_);
+            rcv_.notify_all();
+        }
+        return 1;
+    }
+
+    // Close the broadcast, and it cannot publish any more.
+    // Subscribers still receive the published elements.
+    void Close() {
+        lock lc(mu_);
+        closed_ = true;
+        rcv_.notify_all();
+        wcv_.notify_all();
+    }
+
+    bool IsClosed() {
+        return closed_;
+    }
+
+    size_t Cap() {
+        return cap_;
+    }
+
+private:
+    int _TryRecv(Subscriber<T>* s, T* v) {
+        size_t c = s->cursor_.load();
+        for(;;) {
+            _BroadcastSlot<T>& n = buf_[c & mask_];
+            ptrdiff_t diff = static_cast<ptrdiff_t>(n.seq.load() - (c + 1));
+            if(diff < 0) {  // not published yet
+                if(closed_ && c >= claim_.load()) {
+                    return -1;
+                }
+                return 0;
+            }
+            if(diff == 0) {
+                if(policy_ == BroadcastPolicy::block) {
+                    if(v != nullptr) {
+                        *v = n.data;
+                    }
+                    s->cursor_ = c + 1;
+                    if(writersWaiting_.load() > 0) {
+                        lock lc(mu_);
+                        wcv_.notify_all();
+                    }
+                    return 1;
+                }
+                _ReadLock(n);
+                bool ok = n.seq.load() == c + 1;
+                if(ok && v != nullptr) {
+                    *v = n.data;
+                }
+                n.rw.fetch_sub(1);
+                if(ok) {
+                    s->cursor_ = c + 1;
+                    return 1;
+                }
+            }
+            // overwritten, skip to the oldest element available
+            size_t oldest = claim_.load() - cap_;
+            if(oldest <= c) {
+                oldest = c + 1;
+            }
+            s->dropped_ += oldest - c;
+            c = oldest;
+            s->cursor_ = c;
+        }
+    }
+
+    void _ReadLock(_BroadcastSlot<T>& n) {
+        for(;;) {
+            int r = n.rw.load();
+            if(r >= 0 && n.rw.compare_exchange_weak(r, r + 1)) {
+                return;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    // The cursor of the slowest subscriber, or the next sequence to claim if nobody subscribes.
+    size_t _MinCursor() {
+        lock lc(mu_);
+        size_t min = claim_.load();
+        for(Subscriber<T>* s : subs_) {
+            size_t c = s->cursor_.load();
+            if(c < min) {
+                min = c;
+            }
+        }
+        return min;
+    }
+
+    // Blocking until the element at `c` is published or closed.
+    void _WaitPublished(size_t c) {
+        _BroadcastSlot<T>& n = buf_[c & mask_];
+        lock lc(mu_);
+        readersWaiting_.fetch_add(1);
+        rcv_.wait(lc, [&]() {
+            return closed_ || static_cast<ptrdiff_t>(n.seq.load() - (c + 1)) >= 0;
+        });
+        readersWaiting_.fetch_sub(1);
+    }
+
+    // Blocking until the slowest subscriber moves on or closed.
+    void _WaitGate() {
+        lock lc(mu_);
+        writersWaiting_.fetch_add(1);
+        wcv_.wait(lc, [&]() {
+            size_t pos = claim_.load();
+            if(closed_ || pos < cap_) {
+                return true;
+            }
+            size_t min = pos;
+            for(Subscriber<T>* s : subs_) {
+                size_t c = s->cursor_.load();
+                if(c < min) {
+                    min = c;
+                }
+            }
+            gate_ = min;
+            return pos - cap_ < min;
+        });
+        writersWaiting_.fetch_sub(1);
+    }
+
+    void _Unsubscribe(Subscriber<T>* s) {
+        lock lc(mu_);
+        for(size_t i = 0; i < subs_.size(); i++) {
+            if(subs_[i] == s) {
+                subs_[i] = subs_.back();
+                subs_.pop_back();
+                break;
+            }
+        }
+        wcv_.notify_all();     // the slowest subscriber may be gone
+    }
+
+    _BroadcastSlot<T>* buf_;
+
+    size_t cap_;
+
+    size_t mask_;
+
+    BroadcastPolicy policy_;
+
+    std::atomic<bool> closed_;
+
+    // The next sequence to publish.
+    std::atomic<size_t> claim_;
+
+    // The cached cursor of the slowest subscriber, refreshed when the ring looks full.
+    std::atomic<size_t> gate_;
+
+    std::mutex mu_;
+
+    std::vector<Subscriber<T>*> subs_;
+
+    std::condition_variable rcv_;
+
+    std::condition_variable wcv_;
+
+    std::atomic<int> readersWaiting_;
+
+    std::atomic<int> writersWaiting_;
+};
+
+template <typename T>
+std::shared_ptr<Broadcast<T>> MakeBroadcast(size_t size) {
+    return std::shared_ptr<Broadcast<T>>(new Broadcast<T>(size, BroadcastPolicy::block));
+}
+
+template <typename T>
+std::shared_ptr<Broadcast<T>> MakeBroadcast(size_t size, BroadcastPolicy policy) {
+    return std::shared_ptr<Broadcast<T>>(new Broadcast<T>(size, policy));
+}
+
+template <typename T>
+using SharedBroadcast = std::shared_ptr<Broadcast<T>>;
+
+}
+
+#endif //RTDSYNC_BROADCAST_H
@@ -8,10 +8,55 @@
 #include <memory>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include "notify.h"
+#include "select.h"
+#include "pool.h"
+#include "stats.h"
+#include "trace.h"
 
 namespace rtd {
 
-using TryState = std::function<int(void)>;
+class Context;
+using SharedContext = std::shared_ptr<Context>;
+
+// What Push does when a channel is filled.
+enum class Overflow {
+    // Blocking until there is room, the default.
+    block,
+
+    // Drop the element being pushed.
+    dropNewest,
+
+    // Drop the oldest element in the channel to make room, so the consumer sees the freshest ones.
+    dropOldest
+};
+
+// An operation of a coroutine parked on a channel, completed and woken by the other side.
+template <typename T>
+struct _ChanOp {
+    // `waiter.wake` resumes the coroutine, `waiter.arg` points to the op.
+    _Waiter waiter;
+
+    // Where a pop stores the element, or nullptr.
+    T* out;
+
+    // The element a push hands off.
+    const T* in;
+
+    // 1 if success, 0 if the channel is closed.
+    int res;
+};
+
+#if defined(__cpp_impl_coroutine)
+// The awaiters of a coroutine, defined in coro.h.
+template <typename T>
+class _ChanPopAwaiter;
+
+template <typename T>
+class _ChanPushAwaiter;
+#endif
 
 template<typename T>
 class chan {
@@ -20,8 +65,9 @@ class chan {
 protected:
     // You cannot create a channel by constructor.
     // Using `MakeChan()` to create a shared_ptr is the best practice.
-    chan() : closed_(false) { len_ = 1; }
-    explicit chan(int len) : len_(len), closed_(false) {}
+    chan() : closed_(false), overflow_(Overflow::block), dropped_(0) { len_ = 1; RTDSYNC_STAT(stats_.cap = len_); }
+    explicit chan(int len) : len_(len), closed_(false), overflow_(Overflow::block), dropped_(0) { RTDSYNC_STAT(stats_.cap = len_); }
+    chan(int len, Overflow overflow) : len_(len), closed_(false), overflow_(overflow), dropped_(0) { RTDSYNC_STAT(stats_.cap = len_); }
 
 public:
     template <typename U>
@@ -30,17 +76,29 @@ public:
     template <typename U>
     friend std::shared_ptr<chan<U>> MakeChan(int len);
 
+    template <typename U>
+    friend std::shared_ptr<chan<U>> MakeChan(int len, Overflow overflow);
+
     // Push an element into channel.
-    // Blocking when channel is filled.
-    // Return 1 if success, return 0 if closed.
+    // Blocking when channel is filled, unless the channel drops elements on overflow.
+    // Return 1 if success or dropped, return 0 if closed.
     int Push(const T& v) {
-        lock lc(mu_);
+        lock lc = _Lock();
+        if (closed_) {
+            return 0;
+        }
+        if(q_.size() >= len_ && _Overflow(v)) {
+            return 1;
+        }
+        RTDSYNC_STAT(int64_t blocked = q_.size() >= len_ ? _StatsNow() : 0);
+        RTDSYNC_TRACE_DO(bool traced = _TraceBlock(q_.size() >= len_, this));
+        notFull_.wait(lc, [&](){ return closed_ || q_.size() < len_; });    // blocking if return false
+        RTDSYNC_TRACE_DO(_TraceWake(traced, this));
+        RTDSYNC_STAT(_StatsSince(stats_.pushBlockedNs, stats_.pushBlocks, blocked));
         if (closed_) {
             return 0;
         }
-        cv_.wait(lc, [&](){ return q_.size() < len_; });    // blocking if return false
-        q_.push_back(v);
-        cv_.notify_one();
+        _Enqueue(v);
         return 1;
     }
 
@@ -48,133 +106,304 @@ public:
     // Blocking when channel is empty.
     // Return 1 if success, return 0 if closed and empty.
     int Pop(T* v) {
-        lock lc(mu_);
-        cv_.wait(lc, [&]() { return closed_ || !q_.empty(); });
+        lock lc = _Lock();
+        RTDSYNC_STAT(int64_t blocked = !closed_ && q_.empty() ? _StatsNow() : 0);
+        RTDSYNC_TRACE_DO(bool traced = _TraceBlock(!closed_ && q_.empty(), this));
+        notEmpty_.wait(lc, [&]() { return closed_ || !q_.empty(); });
+        RTDSYNC_TRACE_DO(_TraceWake(traced, this));
+        RTDSYNC_STAT(_StatsSince(stats_.popBlockedNs, stats_.popBlocks, blocked));
         if(q_.empty() && closed_) {
             return 0;
         }
-        if (v != nullptr) {
-            *v = q_.front();
-        }
-        q_.pop_front();
-        cv_.notify_one();
+        _Dequeue(v);
         return 1;
     }
 
+    // Push an element into channel, or give up when `ctx` is done.
+    // Blocking when channel is filled.
+    // Return 1 if success, return 0 if closed, return -3 if ctx is done.
+    // Defined in context.h.
+    int Push(const T& v, const SharedContext& ctx);
+
+    // Pop an element from channel, or give up when `ctx` is done.
+    // Blocking when channel is empty.
+    // Return 1 if success, return 0 if closed and empty, return -3 if ctx is done.
+    // Defined in context.h.
+    int Pop(T* v, const SharedContext& ctx);
+
     // Push an element into channel in non-blocking.
-    // Return 1 if success, return 0 if filled, return -1 if closed.
+    // Return 1 if success or dropped, return 0 if filled, return -1 if closed.
+    // It never returns 0 if the channel drops elements on overflow.
     int TryPush(const T& v) {
-        lock lc(mu_);
+        lock lc = _Lock();
         if (closed_) {
             return -1;
         }
-        if(q_.size() == len_) {
-            return 0;
+        if(q_.size() >= len_) {
+            return _Overflow(v) ? 1 : 0;
         }
-        q_.push_back(v);
-        cv_.notify_one();
+        _Enqueue(v);
         return 1;
     }
 
     // Pop an element from channel in non-blocking.
     // Return 1 if success, return 0 if filled, return -1 if closed.
     int TryPop(T* v) {
-        lock lc(mu_);
+        lock lc = _Lock();
         if(q_.empty() && closed_) {
             return -1;
         }
         if (q_.empty()) {
             return 0;
         }
-        if (v != nullptr) {
-            *v = q_.front();
-        }
-        q_.pop_front();
-        cv_.notify_one();
+        _Dequeue(v);
         return 1;
     }
 
     TryState TryPushState(const T& v) {
-        return [=]() -> int {
+        return [this, v]() -> int {
             return TryPush(v);
         };
     }
 
     TryState TryPopState(T* v) {
-        return [=]() -> int {
+        return [this, v]() -> int {
             return TryPop(v);
         };
     }
 
+    // The case of Select() pushing `v`, whose watchers are woken
+    // whenever an element is pushed or popped, or the channel is closed.
+    SelectCase PushCase(const T& v) {
+        return SelectCase { TryPushState(v), this, &chan::_Watch, &chan::_Unwatch };
+    }
+
+    // The case of Select() popping into `v`.
+    SelectCase PopCase(T* v) {
+        return SelectCase { TryPopState(v), this, &chan::_Watch, &chan::_Unwatch };
+    }
+
+#if defined(__cpp_impl_coroutine)
+    // Pop an element in a coroutine by `co_await ch->AsyncPop(&v)`.
+    // The coroutine is parked on the channel instead of blocking its thread,
+    // and a push hands the element to it directly.
+    // Resume with 1 if success, with 0 if closed and empty. Defined in coro.h.
+    _ChanPopAwaiter<T> AsyncPop(T* v);
+
+    // Push an element in a coroutine by `co_await ch->AsyncPush(v)`.
+    // The coroutine is parked on the channel when it is filled, until a pop takes the element.
+    // Resume with 1 if success or dropped, with 0 if closed. Defined in coro.h.
+    _ChanPushAwaiter<T> AsyncPush(const T& v);
+#endif
+
     // Close a channel and cannot Push element any more.
     void Close() {
         lock lc(mu_);
         closed_ = true;
-        cv_.notify_all();
+        notFull_.notify_all();
+        notEmpty_.notify_all();
+        _CloseOps(asyncPop_);
+        _CloseOps(asyncPush_);
+        watchers_.WakeAll();
     }
 
     bool IsClosed() {
         return closed_;
     }
 
+    // Return the number of elements dropped on overflow.
+    uint64_t Dropped() {
+        return dropped_;
+    }
+
+    // Pop for a coroutine: complete `op` at once and return false,
+    // or park it until a push or Close() completes it and return true.
+    bool _ParkPop(_ChanOp<T>* op) {
+        lock lc = _Lock();
+        if(!q_.empty()) {
+            _Dequeue(op->out);
+            op->res = 1;
+            return false;
+        }
+        if(closed_) {
+            op->res = 0;
+            return false;
+        }
+        op->waiter.arg = op;
+        asyncPop_.Add(&op->waiter);     // the queue stays empty while pop ops are parked
+        return true;
+    }
+
+    // Push for a coroutine: complete `op` at once and return false,
+    // or park it until a pop or Close() completes it and return true.
+    bool _ParkPush(_ChanOp<T>* op) {
+        lock lc = _Lock();
+        if(closed_) {
+            op->res = 0;
+            return false;
+        }
+        if(q_.size() < len_) {
+            _Enqueue(*op->in);
+            op->res = 1;
+            return false;
+        }
+        if(_Overflow(*op->in)) {
+            op->res = 1;
+            return false;
+        }
+        op->waiter.arg = op;
+        asyncPush_.Add(&op->waiter);    // the queue stays filled while push ops are parked
+        return true;
+    }
+
 private:
-    std::list<T> q_;
+    // Lock the channel, and count the contention on its mutex.
+    lock _Lock() {
+#ifdef RTDSYNC_STATS
+        lock lc(mu_, std::try_to_lock);
+        if(!lc.owns_lock()) {
+            int64_t start = _StatsNow();
+            lc.lock();
+            _StatsSince(stats_.lockWaitNs, stats_.lockContended, start);
+        }
+        return lc;
+#else
+        return lock(mu_);
+#endif
+    }
+
+    // Handle a push into the filled channel by the overflow policy, with `mu_` locked.
+    // Return false if the push should block.
+    bool _Overflow(const T& v) {
+        if(overflow_ == Overflow::block) {
+            return false;
+        }
+        ++dropped_;
+        if(overflow_ == Overflow::dropOldest && !q_.empty()) {
+            // overwrite the oldest node and move it to the back, without allocation
+            q_.front() = v;
+            q_.splice(q_.end(), q_, q_.begin());
+        }
+        return true;
+    }
+
+    // Push an element with `mu_` locked and room in the queue,
+    // or hand it off to the earliest parked pop op, as the queue is empty then.
+    void _Enqueue(const T& v) {
+        _Waiter* w = asyncPop_.PopFront();
+        if(w != nullptr) {
+            _ChanOp<T>* op = static_cast<_ChanOp<T>*>(w->arg);
+            if(op->out != nullptr) {
+                *op->out = v;
+            }
+            op->res = 1;
+            RTDSYNC_STAT(stats_.Pushed(0); stats_.Popped(0));
+            RTDSYNC_TRACE_DO(_Trace(TraceEvent::push, this); _Trace(TraceEvent::pop, this));
+            w->wake(w);
+        } else {
+            q_.push_back(v);
+            RTDSYNC_STAT(stats_.Pushed(q_.size()));
+            RTDSYNC_TRACE_DO(_Trace(TraceEvent::push, this));
+            notEmpty_.notify_one();
+        }
+        watchers_.WakeAll();
+    }
+
+    // Pop the front element with `mu_` locked and the queue not empty,
+    // and refill the queue from the earliest parked push op, as the queue was filled then.
+    void _Dequeue(T* v) {
+        if (v != nullptr) {
+            *v = q_.front();
+        }
+        q_.pop_front();
+        RTDSYNC_STAT(stats_.Popped(q_.size()));
+        RTDSYNC_TRACE_DO(_Trace(TraceEvent::pop, this));
+        _Waiter* w = asyncPush_.PopFront();
+        if(w != nullptr) {
+            _ChanOp<T>* op = static_cast<_ChanOp<T>*>(w->arg);
+            q_.push_back(*op->in);
+            op->res = 1;
+            RTDSYNC_STAT(stats_.Pushed(q_.size()));
+            RTDSYNC_TRACE_DO(_Trace(TraceEvent::push, this));
+            w->wake(w);
+        } else {
+            notFull_.notify_one();
+        }
+        watchers_.WakeAll();
+    }
+
+    // Complete all parked ops of a list as closed, with `mu_` locked.
+    static void _CloseOps(_WaitList& ops) {
+        while(_Waiter* w = ops.PopFront()) {
+            static_cast<_ChanOp<T>*>(w->arg)->res = 0;
+            w->wake(w);
+        }
+    }
+
+    static void _Watch(void* c, _Waiter* w) {
+        chan* ch = static_cast<chan*>(c);
+        lock lc(ch->mu_);
+        ch->watchers_.Add(w);
+    }
+
+    static void _Unwatch(void* c, _Waiter* w) {
+        chan* ch = static_cast<chan*>(c);
+        lock lc(ch->mu_);
+        ch->watchers_.Remove(w);
+    }
+
+    // Wake up the operations blocked on the channel of `w->arg`, so that they can check their context.
+    static void _Interrupt(_Waiter* w) {
+        chan* c = static_cast<chan*>(w->arg);
+        lock lc(c->mu_);
+        c->notFull_.notify_all();
+        c->notEmpty_.notify_all();
+    }
+
+    std::list<T, PoolAllocator<T>> q_;
     std::mutex mu_;
-    std::condition_variable cv_;
+    // Producers and consumers wait on their own condition, so that a notify_one() always reaches the other side.
+    std::condition_variable notFull_;
+    std::condition_variable notEmpty_;
     bool closed_;
     int len_;
+    Overflow overflow_;
+    std::atomic<uint64_t> dropped_;
+    // The ops of coroutines parked on the channel, completed in FIFO order.
+    _WaitList asyncPop_;
+    _WaitList asyncPush_;
+    // The Select() calls watching the channel.
+    _WaitList watchers_;
+    RTDSYNC_STAT(_ChanStats stats_{this});
+};
+
+// Make the constructors of chan accessible to std::allocate_shared.
+template <typename T>
+struct _SharedChan : public chan<T> {
+    _SharedChan() : chan<T>() {}
+    explicit _SharedChan(int len) : chan<T>(len) {}
+    _SharedChan(int len, Overflow overflow) : chan<T>(len, overflow) {}
 };
 
 template <typename T>
 std::shared_ptr<chan<T>> MakeChan() {
-    return std::shared_ptr<chan<T>>(new chan<T>());
+    return std::allocate_shared<_SharedChan<T>>(PoolAllocator<_SharedChan<T>>());
 }
 
 template <typename T>
 std::shared_ptr<chan<T>> MakeChan(int len) {
-    return std::shared_ptr<chan<T>>(new chan<T>(len));
+    return std::allocate_shared<_SharedChan<T>>(PoolAllocator<_SharedChan<T>>(), len);
 }
 
+// Make a channel that handles a push into it when filled by `overflow`.
 template <typename T>
-using SharedChan = std::shared_ptr<chan<T>>;
-
-struct SelectOp {
-    int index;
-    TryState func;
-};
-
-// Listening mutli channels by select.
-// select will poll channels to call its TryState function.
-// Return a channel index when its TryState function return 1.
-// Return -1 when all channels were closed.
-// Return -2 when `use_default` is true in one loop if no channel returns.
-int Select(const std::initializer_list<TryState> args, bool use_default = false) {
-    std::vector<SelectOp> ops;
-    int i = 0;
-    for(const TryState& f : args) {
-        ops.push_back(SelectOp { i++, f});
-    }
-    std::random_shuffle(ops.begin(), ops.end());
-
-    while(1) {
-        int closed_num = 0;
-        for(SelectOp& op : ops) {
-            int result = op.func();
-            if(result == 1) {
-                return op.index;
-            } else if(result == -1){
-                ++closed_num;
-            }
-        }
-        if(closed_num == ops.size()) {
-            return -1;
-        }
-        if(use_default) {
-            return -2;
-        }
-    }
+std::shared_ptr<chan<T>> MakeChan(int len, Overflow overflow) {
+    return std::allocate_shared<_SharedChan<T>>(PoolAllocator<_SharedChan<T>>(), len, overflow);
 }
 
+template <typename T>
+using SharedChan = std::shared_ptr<chan<T>>;
+
 }
 
 #endif //RTDCHAN_CHAN_H
\ No newline at end of file
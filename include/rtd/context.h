@@ -0,0 +1,317 @@
+#ifndef RTDSYNC_CONTEXT_H
+#define RTDSYNC_CONTEXT_H
+
+#include "chan.h"
+#include "time.h"
+#include "notify.h"
+#include <utility>
+
+namespace rtd {
+
+// The reason a context is done.
+enum class ContextErr {
+    none,
+    canceled,
+    deadlineExceeded
+};
+
+using CancelFunc = std::function<void()>;
+
+// A Context carries a cancellation signal and a deadline across threads, inspired by Golang context.
+// Contexts form a tree: canceling a context cancels all of its children.
+// Blocking channel operations and Select accept a context, and return -3 as soon as it is done.
+class Context {
+    typedef std::unique_lock<std::mutex> lock;
+
+protected:
+    // You cannot create a context by constructor.
+    // Using `Background()`, `WithCancel()`, `WithDeadline()` or `WithTimeout()`.
+    explicit Context(const SharedContext& parent) : parent_(parent), err_(ContextErr::none), hasDeadline_(false) {}
+
+public:
+    friend SharedContext Background();
+    friend std::pair<SharedContext, CancelFunc> WithCancel(const SharedContext& parent);
+    friend std::pair<SharedContext, CancelFunc> WithDeadline(const SharedContext& parent, time::MonoTimePoint d);
+
+    Context(const Context&) = delete;
+    Context& operator=(const Context&) = delete;
+
+    ~Context() {
+        if(parent_ != nullptr) {
+            parent_->_RemoveWaiter(&parentHook_);
+        }
+        if(timer_ != nullptr) {
+            time::_StopTimer(timer_);
+        }
+    }
+
+    // Return a channel that is closed when the context is done.
+    SharedChan<bool> Done() {
+        lock lc(mu_);
+        if(done_ == nullptr) {
+            done_ = MakeChan<bool>();
+            if(err_ != ContextErr::none) {
+                done_->Close();
+            }
+        }
+        return done_;
+    }
+
+    // Return why the context is done, or `ContextErr::none` if it is not done.
+    ContextErr Err() {
+        return err_;
+    }
+
+    bool IsDone() {
+        return err_ != ContextErr::none;
+    }
+
+    // Return false if the context has no deadline.
+    bool Deadline(time::MonoTimePoint* d) {
+        if(hasDeadline_ && d != nullptr) {
+            *d = deadline_;
+        }
+        return hasDeadline_;
+    }
+
+    // Register a waiter woken when the context is done.
+    // Return false without registering if the context is done already.
+    bool _AddWaiter(_Waiter* w) {
+        if(parent_ == nullptr) {    // Background() is never done
+            return true;
+        }
+        lock lc(mu_);
+        if(err_ != ContextErr::none) {
+            return false;
+        }
+        waiters_.Add(w);
+        return true;
+    }
+
+    // Remove a waiter. It waits for a running cancellation to finish waking it.
+    void _RemoveWaiter(_Waiter* w) {
+        if(parent_ == nullptr) {
+            return;
+        }
+        lock lc(mu_);
+        waiters_.Remove(w);
+    }
+
+    // IsDone() of the context `ctx`, for Select().
+    static bool _IsDone(void* ctx) {
+        return static_cast<Context*>(ctx)->IsDone();
+    }
+
+    void _Cancel(ContextErr err) {
+        lock lc(mu_);
+        if(err_ != ContextErr::none) {
+            return;
+        }
+        err_ = err;
+        if(done_ != nullptr) {
+            done_->Close();
+        }
+        waiters_.WakeAll();     // blocked operations and children
+    }
+
+private:
+    static void _Expire(time::_Timer* t, int64_t) {
+        static_cast<Context*>(t->arg.get())->_Cancel(ContextErr::deadlineExceeded);
+    }
+
+    // Propagate the cancellation of the parent to a child.
+    static void _CancelChild(_Waiter* w) {
+        Context* child = static_cast<Context*>(w->arg);
+        child->_Cancel(child->parent_->Err());
+    }
+
+    // Link a new child to its parent, or cancel it at once if the parent is done.
+    // The child inherits the deadline of its parent.
+    void _Attach() {
+        if(parent_ == nullptr) {
+            return;
+        }
+        hasDeadline_ = parent_->Deadline(&deadline_);
+        parentHook_.arg = this;
+        parentHook_.wake = &Context::_CancelChild;
+        if(!parent_->_AddWaiter(&parentHook_)) {
+            _Cancel(parent_->Err());
+        }
+    }
+
+    SharedContext parent_;
+
+    std::mutex mu_;
+
+    std::atomic<ContextErr> err_;
+
+    SharedChan<bool> done_;
+
+    _WaitList waiters_;
+
+    _Waiter parentHook_;
+
+    bool hasDeadline_;
+
+    time::MonoTimePoint deadline_;
+
+    time::_SharedTimer timer_;
+};
+
+// Return the root context, which is never canceled and has no deadline.
+inline SharedContext Background() {
+    static SharedContext* bg = new SharedContext(new Context(nullptr));
+    return *bg;
+}
+
+// Return a child context, and the function to cancel it.
+inline std::pair<SharedContext, CancelFunc> WithCancel(const SharedContext& parent) {
+    SharedContext ctx(new Context(parent));
+    ctx->_Attach();
+    std::weak_ptr<Context> weak = ctx;
+    return std::make_pair(ctx, CancelFunc([weak]() {
+        SharedContext c = weak.lock();
+        if(c != nullptr) {
+            c->_Cancel(ContextErr::canceled);
+        }
+    }));
+}
+
+// Return a child context that is done at `d` by the timers heap, and the function to cancel it.
+// The deadline of the parent is kept if it is earlier.
+inline std::pair<SharedContext, CancelFunc> WithDeadline(const SharedContext& parent, time::MonoTimePoint d) {
+    time::MonoTimePoint pd;
+    if(parent->Deadline(&pd) && pd <= d) {
+        return WithCancel(parent);
+    }
+    std::pair<SharedContext, CancelFunc> res = WithCancel(parent);
+    Context* ctx = res.first.get();
+    ctx->hasDeadline_ = true;
+    ctx->deadline_ = d;
+    if(ctx->IsDone()) {
+        return res;
+    }
+    if(d <= time::MonoNow()) {
+        ctx->_Cancel(ContextErr::deadlineExceeded);
+        return res;
+    }
+
+    time::_SharedTimer t = time::_NewTimer();
+    t->when = d;
+    t->arg = std::shared_ptr<void>(std::shared_ptr<void>(), ctx);  // not owned, the context stops the timer before it is destroyed
+    t->Do = &Context::_Expire;
+    ctx->timer_ = t;
+    time::_AddTimer(t);
+    return res;
+}
+
+template <typename T, typename U>
+std::pair<SharedContext, CancelFunc> WithTimeout(const SharedContext& parent, std::chrono::duration<T, U> timeout) {
+    return WithDeadline(parent, time::When(timeout));
+}
+
+template <typename T>
+int chan<T>::Push(const T& v, const SharedContext& ctx) {
+    _Waiter w;
+    w.arg = this;
+    w.wake = &chan<T>::_Interrupt;
+    if(!ctx->_AddWaiter(&w)) {
+        return -3;
+    }
+    int res = 1;
+    {
+        lock lc = _Lock();
+        bool dropped = !closed_ && q_.size() >= len_ && _Overflow(v);
+        if(!dropped) {
+            RTDSYNC_STAT(int64_t blocked = !closed_ && q_.size() >= len_ ? _StatsNow() : 0);
+            RTDSYNC_TRACE_DO(bool traced = _TraceBlock(!closed_ && q_.size() >= len_, this));
+            notFull_.wait(lc, [&]() { return closed_ || q_.size() < len_ || ctx->IsDone(); });
+            RTDSYNC_TRACE_DO(_TraceWake(traced, this));
+            RTDSYNC_STAT(_StatsSince(stats_.pushBlockedNs, stats_.pushBlocks, blocked));
+            if(closed_) {
+                res = 0;
+            } else if(q_.size() < len_) {
+                _Enqueue(v);
+            } else {
+                res = -3;
+            }
+        }
+    }
+    ctx->_RemoveWaiter(&w);
+    return res;
+}
+
+template <typename T>
+int chan<T>::Pop(T* v, const SharedContext& ctx) {
+    _Waiter w;
+    w.arg = this;
+    w.wake = &chan<T>::_Interrupt;
+    if(!ctx->_AddWaiter(&w)) {
+        return -3;
+    }
+    int res = 1;
+    {
+        lock lc = _Lock();
+        RTDSYNC_STAT(int64_t blocked = !closed_ && q_.empty() ? _StatsNow() : 0);
+        RTDSYNC_TRACE_DO(bool traced = _TraceBlock(!closed_ && q_.empty(), this));
+        notEmpty_.wait(lc, [&]() { return closed_ || !q_.empty() || ctx->IsDone(); });
+        RTDSYNC_TRACE_DO(_TraceWake(traced, this));
+        RTDSYNC_STAT(_StatsSince(stats_.popBlockedNs, stats_.popBlocks, blocked));
+        if(!q_.empty()) {
+            _Dequeue(v);
+        } else if(closed_) {
+            res = 0;
+        } else {
+            res = -3;
+        }
+    }
+    ctx->_RemoveWaiter(&w);
+    return res;
+}
+
+// Poll the cases, and park on them and on `ctx` if none is ready.
+inline int _SelectUntilDone(const SharedContext& ctx, std::vector<_SelectCaseOp>& ops, bool use_default) {
+    int res = _PollCases(ops);
+    if(res != -2 || use_default) {
+        return res;
+    }
+    _SelectParker p(ops);
+    if(!ctx->_AddWaiter(p.Extra())) {
+        return -3;
+    }
+    res = p.Select(&Context::_IsDone, ctx.get());
+    ctx->_RemoveWaiter(p.Extra());
+    return res;
+}
+
+// Listening mutli channels by select, and give up when `ctx` is done.
+// TryState functions cannot be watched, so the thread polls them with a backoff growing up to 1ms,
+// parked on `ctx` in between, so canceling it wakes the thread at once.
+// Return a channel index when its TryState function return 1.
+// Return -1 when all channels were closed.
+// Return -2 when `use_default` is true in one loop if no channel returns.
+// Return -3 when ctx is done.
+inline int Select(const SharedContext& ctx, const std::initializer_list<TryState> args, bool use_default = false) {
+    if(ctx->IsDone()) {
+        return -3;
+    }
+    std::vector<_SelectCaseOp> ops = _SelectCases(args);
+    return _SelectUntilDone(ctx, ops, use_default);
+}
+
+// Listening multi objects by select, and give up when `ctx` is done.
+// The thread is parked on all of the objects and on `ctx`, until one of them changes.
+// Return a case index when its operation succeeds.
+// Return -1 when all cases never succeed any more, such as on closed channels.
+// Return -2 when `use_default` is true and no case is ready.
+// Return -3 when ctx is done.
+inline int Select(const SharedContext& ctx, const std::initializer_list<SelectCase> args, bool use_default = false) {
+    if(ctx->IsDone()) {
+        return -3;
+    }
+    std::vector<_SelectCaseOp> ops = _SelectCases(args);
+    return _SelectUntilDone(ctx, ops, use_default);
+}
+}
+
+#endif //RTDSYNC_CONTEXT_H
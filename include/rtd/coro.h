@@ -0,0 +1,623 @@
+#ifndef RTDSYNC_CORO_H
+#define RTDSYNC_CORO_H
+
+#if !defined(__cpp_impl_coroutine)
+#error "coro.h requires C++20 coroutines"
+#endif
+
+#include "chan.h"
+#include "time.h"
+#include "waitgroup.h"
+#include <coroutine>
+#include <exception>
+#include <stdexcept>
+#include <optional>
+#include <utility>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <random>
+#include <mutex>
+#include <condition_variable>
+
+// C++20 coroutines on channels, Select, timers and WaitGroup.
+// A coroutine awaiting them is parked on the waiter list of the channel or WaitGroup,
+// or on the timers heap, instead of blocking its thread;
+// whoever completes the operation posts it to the executor it was running on, which resumes it.
+
+namespace rtd {
+
+// An Executor resumes coroutines on its threads.
+class Executor {
+public:
+    virtual ~Executor() {}
+
+    // Resume `h` later on a thread of the executor.
+    // Must be a non-blocking function, since it is called with the locks of channels held.
+    virtual void Post(std::coroutine_handle<> h) = 0;
+};
+
+// The executor whose thread is running, or nullptr.
+inline Executor*& _CurrentExecutor() {
+    static thread_local Executor* e = nullptr;
+    return e;
+}
+
+// An Executor resuming coroutines in FIFO order on a fixed number of threads.
+class ThreadPool : public Executor {
+    typedef std::unique_lock<std::mutex> lock;
+
+public:
+    explicit ThreadPool(int threads) : stop_(false) {
+        for(int i = 0; i < (threads < 1 ? 1 : threads); i++) {
+            threads_.emplace_back(&ThreadPool::_Run, this);
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Stop the threads after the posted coroutines have run.
+    // Coroutines still parked on channels or timers are never resumed.
+    ~ThreadPool() {
+        {
+            lock lc(mu_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for(std::thread& t : threads_) {
+            t.join();
+        }
+    }
+
+    void Post(std::coroutine_handle<> h) override {
+        {
+            lock lc(mu_);
+            q_.push_back(h);
+        }
+        cv_.notify_one();
+    }
+
+private:
+    void _Run() {
+        _CurrentExecutor() = this;
+        while(1) {
+            std::coroutine_handle<> h;
+            {
+                lock lc(mu_);
+                cv_.wait(lc, [&]() { return stop_ || !q_.empty(); });
+                if(q_.empty()) {
+                    return;
+                }
+                h = q_.front();
+                q_.pop_front();
+            }
+            h.resume();
+        }
+    }
+
+    std::mutex mu_;
+
+    std::condition_variable cv_;
+
+    std::deque<std::coroutine_handle<>> q_;
+
+    bool stop_;
+
+    std::vector<std::thread> threads_;
+};
+
+// The executor of coroutines spawned without one, a pool with a thread per core.
+// It is never destroyed, so that coroutines can still be posted in static destructors.
+inline Executor& DefaultExecutor() {
+    static ThreadPool* pool = new ThreadPool(static_cast<int>(std::thread::hardware_concurrency()));
+    return *pool;
+}
+
+// The executor whose thread is running, or the default one.
+// A parked coroutine is resumed on the executor it was parked from.
+inline Executor& CurrentExecutor() {
+    Executor* e = _CurrentExecutor();
+    return e != nullptr ? *e : DefaultExecutor();
+}
+
+template <typename T>
+class Task;
+
+struct _TaskPromiseBase {
+    // Transfer to the awaiting coroutine when the task completes, without growing the stack.
+    struct FinalAwaiter {
+        bool await_ready() noexcept {
+            return false;
+        }
+
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+            std::coroutine_handle<> c = h.promise().continuation;
+            return c ? c : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept {
+        return {};
+    }
+
+    FinalAwaiter final_suspend() noexcept {
+        return {};
+    }
+
+    void unhandled_exception() {
+        error = std::current_exception();
+    }
+
+    // The coroutine awaiting the task.
+    std::coroutine_handle<> continuation;
+
+    std::exception_ptr error;
+};
+
+template <typename T>
+struct _TaskPromise : _TaskPromiseBase {
+    Task<T> get_return_object();
+
+    void return_value(T v) {
+        value.emplace(std::move(v));
+    }
+
+    T Result() {
+        if(error) {
+            std::rethrow_exception(error);
+        }
+        return std::move(*value);
+    }
+
+    std::optional<T> value;
+};
+
+template <>
+struct _TaskPromise<void> : _TaskPromiseBase {
+    Task<void> get_return_object();
+
+    void return_void() {}
+
+    void Result() {
+        if(error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+// A Task is a coroutine returning T, started lazily when it is awaited.
+// An exception thrown by the task is rethrown to the awaiting coroutine.
+template <typename T = void>
+class Task {
+public:
+    using promise_type = _TaskPromise<T>;
+
+    explicit Task(std::coroutine_handle<promise_type> h) : h_(h) {}
+
+    Task(Task&& t) noexcept : h_(std::exchange(t.h_, nullptr)) {}
+
+    Task& operator=(Task&& t) noexcept {
+        if(this != &t) {
+            if(h_) {
+                h_.destroy();
+            }
+            h_ = std::exchange(t.h_, nullptr);
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+        if(h_) {
+            h_.destroy();
+        }
+    }
+
+    bool await_ready() noexcept {
+        return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> c) noexcept {
+        h_.promise().continuation = c;
+        return h_;
+    }
+
+    T await_resume() {
+        return h_.promise().Result();
+    }
+
+private:
+    std::coroutine_handle<promise_type> h_;
+};
+
+template <typename T>
+Task<T> _TaskPromise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<_TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> _TaskPromise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<_TaskPromise<void>>::from_promise(*this));
+}
+
+// A coroutine that nobody awaits, it frees itself when it completes.
+struct _Detached {
+    struct promise_type {
+        _Detached get_return_object() {
+            return _Detached { std::coroutine_handle<promise_type>::from_promise(*this) };
+        }
+
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+
+        void return_void() {}
+
+        void unhandled_exception() {
+            std::terminate();
+        }
+    };
+
+    std::coroutine_handle<promise_type> h;
+};
+
+inline _Detached _RunDetached(Task<void> t) {
+    co_await t;
+}
+
+// Run a task on an executor without waiting for it.
+// Like a std::thread, an exception escaping the task terminates the process.
+inline void Spawn(Executor& ex, Task<void> t) {
+    ex.Post(_RunDetached(std::move(t)).h);
+}
+
+// Run a task on the current executor without waiting for it.
+inline void Spawn(Task<void> t) {
+    Spawn(CurrentExecutor(), std::move(t));
+}
+
+// The completion of SyncWait(), notified with the lock held,
+// so the waiter cannot return and destroy it while the notifier still touches it, unlike a _Sema.
+struct _SyncDone {
+    std::mutex mu;
+    std::condition_variable cv;
+    bool done = false;
+
+    void Notify() {
+        std::lock_guard<std::mutex> lc(mu);
+        done = true;
+        cv.notify_one();
+    }
+
+    void Wait() {
+        std::unique_lock<std::mutex> lc(mu);
+        cv.wait(lc, [&]() { return done; });
+    }
+};
+
+template <typename T>
+_Detached _RunSync(Task<T>& t, std::optional<T>& res, std::exception_ptr& err, _SyncDone& done) {
+    try {
+        res.emplace(co_await t);
+    } catch(...) {
+        err = std::current_exception();
+    }
+    done.Notify();
+}
+
+inline _Detached _RunSync(Task<void>& t, std::exception_ptr& err, _SyncDone& done) {
+    try {
+        co_await t;
+    } catch(...) {
+        err = std::current_exception();
+    }
+    done.Notify();
+}
+
+// Run a task on an executor, blocking the calling thread until it completes, and return its result.
+// Do not call it on a thread of the executor, the task may need that thread to complete.
+template <typename T>
+T SyncWait(Executor& ex, Task<T> t) {
+    std::optional<T> res;
+    std::exception_ptr err;
+    _SyncDone done;
+    ex.Post(_RunSync(t, res, err, done).h);
+    done.Wait();
+    if(err) {
+        std::rethrow_exception(err);
+    }
+    return std::move(*res);
+}
+
+inline void SyncWait(Executor& ex, Task<void> t) {
+    std::exception_ptr err;
+    _SyncDone done;
+    ex.Post(_RunSync(t, err, done).h);
+    done.Wait();
+    if(err) {
+        std::rethrow_exception(err);
+    }
+}
+
+// Run a task on the default executor, blocking the calling thread until it completes.
+template <typename T>
+T SyncWait(Task<T> t) {
+    return SyncWait(DefaultExecutor(), std::move(t));
+}
+
+// The awaiter of a coroutine parked on a channel.
+template <typename T>
+class _ChanAwaiter : protected _ChanOp<T> {
+public:
+    bool await_ready() noexcept {
+        return false;
+    }
+
+    int await_resume() noexcept {
+        return this->res;
+    }
+
+protected:
+    explicit _ChanAwaiter(chan<T>* c) : c_(c), h_(nullptr), ex_(nullptr) {
+        this->out = nullptr;
+        this->in = nullptr;
+        this->res = 0;
+    }
+
+    // Prepare to park the coroutine `h`.
+    void _Prepare(std::coroutine_handle<> h) {
+        h_ = h;
+        ex_ = &CurrentExecutor();
+        this->waiter.wake = &_ChanAwaiter::_Wake;
+    }
+
+    static void _Wake(_Waiter* w) {
+        _ChanAwaiter* a = static_cast<_ChanAwaiter*>(static_cast<_ChanOp<T>*>(w->arg));
+        a->ex_->Post(a->h_);
+    }
+
+    chan<T>* c_;
+
+    std::coroutine_handle<> h_;
+
+    Executor* ex_;
+};
+
+template <typename T>
+class _ChanPopAwaiter : public _ChanAwaiter<T> {
+public:
+    _ChanPopAwaiter(chan<T>* c, T* v) : _ChanAwaiter<T>(c) {
+        this->out = v;
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) {
+        this->_Prepare(h);
+        return this->c_->_ParkPop(this);
+    }
+};
+
+template <typename T>
+class _ChanPushAwaiter : public _ChanAwaiter<T> {
+public:
+    _ChanPushAwaiter(chan<T>* c, const T& v) : _ChanAwaiter<T>(c), v_(v) {}
+
+    bool await_suspend(std::coroutine_handle<> h) {
+        this->_Prepare(h);
+        this->in = &v_;     // not before, the awaiter may have been moved
+        return this->c_->_ParkPush(this);
+    }
+
+private:
+    T v_;
+};
+
+template <typename T>
+_ChanPopAwaiter<T> chan<T>::AsyncPop(T* v) {
+    return _ChanPopAwaiter<T>(this, v);
+}
+
+template <typename T>
+_ChanPushAwaiter<T> chan<T>::AsyncPush(const T& v) {
+    return _ChanPushAwaiter<T>(this, v);
+}
+
+// The awaiter of a coroutine parked on a WaitGroup.
+class _WaitGroupAwaiter {
+public:
+    explicit _WaitGroupAwaiter(WaitGroup* wg) : wg_(wg), h_(nullptr), ex_(nullptr) {}
+
+    bool await_ready() noexcept {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) {
+        h_ = h;
+        ex_ = &CurrentExecutor();
+        w_.arg = this;
+        w_.wake = &_WaitGroupAwaiter::_Wake;
+        return wg_->_Park(&w_);
+    }
+
+    void await_resume() noexcept {}
+
+private:
+    static void _Wake(_Waiter* w) {
+        _WaitGroupAwaiter* a = static_cast<_WaitGroupAwaiter*>(w->arg);
+        a->ex_->Post(a->h_);
+    }
+
+    WaitGroup* wg_;
+
+    _Waiter w_;
+
+    std::coroutine_handle<> h_;
+
+    Executor* ex_;
+};
+
+inline _WaitGroupAwaiter WaitGroup::AsyncWait() {
+    return _WaitGroupAwaiter(this);
+}
+
+// The awaiter of one round of AsyncSelect().
+// It watches all objects before polling them, so a change after the poll is not missed,
+// and parks the coroutine until any object changes; then the caller polls again.
+class _SelectAwaiter {
+    enum State { polling, parked, woken };
+
+public:
+    explicit _SelectAwaiter(std::vector<_SelectCaseOp>& ops) : ops_(ops), watchers_(ops.size()),
+            state_(polling), res_(-2), h_(nullptr), ex_(nullptr) {}
+
+    bool await_ready() noexcept {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) {
+        h_ = h;
+        ex_ = &CurrentExecutor();
+        for(size_t i = 0; i < ops_.size(); i++) {
+            watchers_[i].arg = this;
+            watchers_[i].wake = &_SelectAwaiter::_Wake;
+            ops_[i].c.watch(ops_[i].c.obj, &watchers_[i]);
+        }
+        res_ = _PollCases(ops_);
+        if(res_ == -2) {
+            int s = polling;
+            if(state_.compare_exchange_strong(s, parked)) {
+                return true;
+            }
+        }
+        _Unwatch();     // done, or a channel has changed while polling
+        return false;
+    }
+
+    // Return the chosen index, -1 if all channels are closed, or -2 to poll again.
+    int await_resume() {
+        if(state_.load() != polling) {
+            _Unwatch();
+        }
+        return res_;
+    }
+
+private:
+    // A channel has changed, called with its lock held.
+    static void _Wake(_Waiter* w) {
+        _SelectAwaiter* a = static_cast<_SelectAwaiter*>(w->arg);
+        if(a->state_.exchange(woken) == parked) {
+            a->ex_->Post(a->h_);
+        }
+    }
+
+    // Once it returns, no channel calls _Wake() any more.
+    void _Unwatch() {
+        for(size_t i = 0; i < ops_.size(); i++) {
+            ops_[i].c.unwatch(ops_[i].c.obj, &watchers_[i]);
+        }
+        state_ = polling;
+    }
+
+    std::vector<_SelectCaseOp>& ops_;
+
+    std::vector<_Waiter> watchers_;
+
+    std::atomic<int> state_;
+
+    int res_;
+
+    std::coroutine_handle<> h_;
+
+    Executor* ex_;
+};
+
+// Listening multi objects by select in a coroutine, like Select() of cases,
+// by `co_await AsyncSelect({ch1->PopCase(&v), ch2->PushCase(x)})`.
+// The coroutine is parked on all objects until one of them changes, instead of polling them.
+// Return a case index when its operation succeeds.
+// Return -1 when all channels were closed.
+// Return -2 when `use_default` is true and no case is ready.
+// Every case must be watchable, so plain TryState functions are not accepted.
+inline Task<int> AsyncSelect(std::vector<SelectCase> cases, bool use_default = false) {
+    static thread_local std::minstd_rand rand(std::random_device{}());
+    std::vector<_SelectCaseOp> ops;
+    int i = 0;
+    for(SelectCase& c : cases) {
+        if(c.watch == nullptr) {
+            throw std::logic_error("AsyncSelect() needs cases that can be watched.");
+        }
+        ops.push_back(_SelectCaseOp { i++, std::move(c) });
+    }
+    std::shuffle(ops.begin(), ops.end(), rand);
+
+    if(use_default) {
+        co_return _PollCases(ops);
+    }
+    while(1) {
+        int res = co_await _SelectAwaiter(ops);
+        if(res != -2) {
+            co_return res;
+        }
+    }
+}
+
+namespace time {
+
+// The awaiter of a coroutine parked on the timers heap.
+class _SleepAwaiter {
+public:
+    explicit _SleepAwaiter(MonoTimePoint when) : when_(when), h_(nullptr), ex_(nullptr) {}
+
+    bool await_ready() {
+        return when_ <= MonoNow();
+    }
+
+    void await_suspend(std::coroutine_handle<> h) {
+        h_ = h;
+        ex_ = &CurrentExecutor();
+        _SharedTimer t = _NewTimer();
+        t->when = when_;
+        t->arg = std::shared_ptr<void>(std::shared_ptr<void>(), this);    // not owned, the coroutine is parked until it fires
+        t->Do = &_SleepAwaiter::_Fire;
+        _AddTimer(t);
+    }
+
+    void await_resume() noexcept {}
+
+private:
+    static void _Fire(_Timer* t, int64_t) {
+        _SleepAwaiter* a = static_cast<_SleepAwaiter*>(t->arg.get());
+        a->ex_->Post(a->h_);
+    }
+
+    MonoTimePoint when_;
+
+    std::coroutine_handle<> h_;
+
+    Executor* ex_;
+};
+
+// Sleep in a coroutine by `co_await time::Sleep(d)`, without blocking its thread.
+template <typename T, typename U>
+_SleepAwaiter Sleep(duration<T, U> d) {
+    return _SleepAwaiter(When(d));
+}
+
+// Sleep in a coroutine until the monotonic time point `when`.
+inline _SleepAwaiter SleepUntil(MonoTimePoint when) {
+    return _SleepAwaiter(when);
+}
+
+}
+
+}
+
+#endif //RTDSYNC_CORO_H
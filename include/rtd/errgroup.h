@@ -0,0 +1,152 @@
+#ifndef RTDSYNC_ERRGROUP_H
+#define RTDSYNC_ERRGROUP_H
+
+#include "chan.h"
+#include "waitgroup.h"
+#include <deque>
+#include <thread>
+#include <exception>
+
+namespace rtd {
+
+// An ErrGroup runs a group of tasks, and collects the first error of them, inspired by Golang errgroup.
+// A task fails by throwing an exception.
+// The first failure cancels the group, so that the remaining tasks can stop early.
+class ErrGroup : public std::enable_shared_from_this<ErrGroup> {
+    typedef std::unique_lock<std::mutex> lock;
+
+protected:
+    ErrGroup() : wg_(MakeWaitGroup()), done_(MakeChan<bool>()), canceled_(false), limit_(0), workers_(0) {}
+
+public:
+    using Task = std::function<void()>;
+
+    friend std::shared_ptr<ErrGroup> MakeErrGroup();
+
+    // Limit the number of tasks running at the same time.
+    // The tasks beyond the limit are queued, and run by at most `n` worker threads.
+    // `n <= 0` means no limit, and each task runs in its own thread.
+    // It must be called before Go().
+    void SetLimit(int n) {
+        lock lc(mu_);
+        if(workers_ > 0) {
+            throw std::logic_error("cannot set limit of ErrGroup with running tasks.");
+        }
+        limit_ = n;
+    }
+
+    // Run a task in the group.
+    // It never blocks. A task that has not started when the group is canceled is skipped.
+    void Go(Task f) {
+        wg_->Add(1);
+        std::shared_ptr<ErrGroup> self = shared_from_this();
+        lock lc(mu_);
+        if(limit_ <= 0) {
+            lc.unlock();
+            std::thread([self, f]() {
+                self->_Run(f);
+            }).detach();
+            return;
+        }
+        queue_.push_back(std::move(f));
+        if(workers_ < limit_) {
+            ++workers_;
+            lc.unlock();
+            std::thread([self]() {
+                self->_Work();
+            }).detach();
+        }
+    }
+
+    // Blocking until all tasks being done.
+    // Return the first exception thrown by a task, or nullptr if all of them succeed.
+    // The group is canceled when Wait() returns.
+    std::exception_ptr Wait() {
+        wg_->Wait();
+        Cancel();
+        lock lc(mu_);
+        return err_;
+    }
+
+    // Cancel the group.
+    // Running tasks should check Canceled() or Done() to stop early.
+    void Cancel() {
+        bool expected = false;
+        if(canceled_.compare_exchange_strong(expected, true)) {
+            done_->Close();
+        }
+    }
+
+    bool Canceled() {
+        return canceled_;
+    }
+
+    // Return a channel that is closed when the group is canceled.
+    SharedChan<bool> Done() {
+        return done_;
+    }
+
+private:
+    void _Run(const Task& f) {
+        if(!canceled_) {
+            try {
+                f();
+            } catch(...) {
+                _Fail(std::current_exception());
+            }
+        }
+        wg_->Done();
+    }
+
+    // The loop of a worker thread, exiting when the queue is empty.
+    void _Work() {
+        for(;;) {
+            Task f;
+            {
+                lock lc(mu_);
+                if(queue_.empty()) {
+                    --workers_;
+                    return;
+                }
+                f = std::move(queue_.front());
+                queue_.pop_front();
+            }
+            _Run(f);
+        }
+    }
+
+    void _Fail(std::exception_ptr err) {
+        {
+            lock lc(mu_);
+            if(err_ != nullptr) {
+                return;
+            }
+            err_ = err;
+        }
+        Cancel();
+    }
+
+    std::shared_ptr<WaitGroup> wg_;
+
+    SharedChan<bool> done_;
+
+    std::atomic<bool> canceled_;
+
+    std::mutex mu_;
+
+    std::exception_ptr err_;
+
+    std::deque<Task> queue_;
+
+    int limit_;
+
+    int workers_;
+};
+
+inline std::shared_ptr<ErrGroup> MakeErrGroup() {
+    return std::shared_ptr<ErrGroup>(new ErrGroup());
+}
+
+}
+
+#endif //RTDSYNC_ERRGROUP_H
@@ -0,0 +1,90 @@
+#ifndef RTDSYNC_NOTIFY_H
+#define RTDSYNC_NOTIFY_H
+
+namespace rtd {
+
+// An intrusive node of a _WaitList.
+// It usually lives on the stack of a blocked operation, so registering it never allocates.
+struct _Waiter {
+    _Waiter* prev;
+    _Waiter* next;
+
+    // Called by the owner of the list with the owner's lock held.
+    // Must be an non-blocking function, and must not remove the waiter from the list.
+    void (*wake)(_Waiter* w);
+
+    // The argument of `wake`.
+    void* arg;
+
+    _Waiter() : prev(nullptr), next(nullptr), wake(nullptr), arg(nullptr) {}
+};
+
+// An intrusive FIFO list of waiters.
+// It is not thread-safe, and it is guarded by the lock of its owner.
+// A waiter is removed by whoever added it, after it has been woken or has given up,
+// unless the owner hands it off with PopFront().
+class _WaitList {
+public:
+    _WaitList() : head_(nullptr), tail_(nullptr) {}
+
+    void Add(_Waiter* w) {
+        w->prev = tail_;
+        w->next = nullptr;
+        if(tail_ != nullptr) {
+            tail_->next = w;
+        } else {
+            head_ = w;
+        }
+        tail_ = w;
+    }
+
+    void Remove(_Waiter* w) {
+        if(w->prev != nullptr) {
+            w->prev->next = w->next;
+        } else if(head_ == w) {
+            head_ = w->next;
+        } else {    // not in the list
+            return;
+        }
+        if(w->next != nullptr) {
+            w->next->prev = w->prev;
+        } else {
+            tail_ = w->prev;
+        }
+        w->prev = nullptr;
+        w->next = nullptr;
+    }
+
+    bool Empty() {
+        return head_ == nullptr;
+    }
+
+    // Return the earliest waiter without removing it, or nullptr if the list is empty.
+    _Waiter* Front() {
+        return head_;
+    }
+
+    // Remove and return the earliest waiter, or nullptr if the list is empty.
+    // The caller completes its operation and wakes it, and the waiter must not remove itself.
+    _Waiter* PopFront() {
+        _Waiter* w = head_;
+        if(w != nullptr) {
+            Remove(w);
+        }
+        return w;
+    }
+
+    void WakeAll() {
+        for(_Waiter* w = head_; w != nullptr; w = w->next) {
+            w->wake(w);
+        }
+    }
+
+private:
+    _Waiter* head_;
+    _Waiter* tail_;
+};
+
+}
+
+#endif //RTDSYNC_NOTIFY_H
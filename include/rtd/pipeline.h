@@ -0,0 +1,275 @@
+#ifndef RTDSYNC_PIPELINE_H
+#define RTDSYNC_PIPELINE_H
+
+#include "chan.h"
+#include "pool.h"
+#include <map>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <type_traits>
+#include <stdexcept>
+
+namespace rtd {
+
+// A batch of elements passed between the stages of a pipeline.
+// `seq` numbers the batches in the order of the source, so an ordered stage can restore it.
+template <typename T>
+struct _Batch {
+    uint64_t seq;
+    std::vector<T> items;
+};
+
+// Batches are passed by pointer, a channel copies its elements.
+template <typename T>
+using _SharedBatch = std::shared_ptr<_Batch<T>>;
+
+template <typename T>
+_SharedBatch<T> _NewBatch(uint64_t seq, size_t cap) {
+    _SharedBatch<T> b = std::allocate_shared<_Batch<T>>(PoolAllocator<_Batch<T>>());
+    b->seq = seq;
+    b->items.reserve(cap);
+    return b;
+}
+
+// The output of a stage, shared by its workers.
+// The last worker to exit closes the channel, so the next stage sees the end of the stream.
+// In order, a worker hands its batch to the channel when all earlier batches have been,
+// or parks it in the reorder buffer of at most `window` batches, or waits for room there.
+template <typename T>
+class _StageOut {
+    typedef std::unique_lock<std::mutex> lock;
+
+public:
+    _StageOut(const SharedChan<_SharedBatch<T>>& out, int workers, size_t window)
+            : out_(out), running_(workers), window_(window), next_(0), stopped_(false) {}
+
+    // Emit a batch of a worker, even an empty one, so an ordered stage downstream sees every sequence.
+    // Return false if the channel has been closed by the consumer, and the stage should stop.
+    bool Emit(const _SharedBatch<T>& b) {
+        if(window_ == 0) {
+            return out_->Push(b) == 1;
+        }
+        lock lc(mu_);
+        cv_.wait(lc, [&]() { return stopped_ || b->seq == next_ || pending_.size() < window_; });
+        if(stopped_) {
+            return false;
+        }
+        if(b->seq != next_) {
+            pending_[b->seq] = b;
+            return true;
+        }
+        // hand off the batch and the ones waiting for it, in order
+        bool ok = out_->Push(b) == 1;
+        ++next_;
+        typename std::map<uint64_t, _SharedBatch<T>>::iterator it = pending_.begin();
+        while(ok && it != pending_.end() && it->first == next_) {
+            ok = out_->Push(it->second) == 1;
+            ++next_;
+            it = pending_.erase(it);
+        }
+        if(!ok) {
+            stopped_ = true;
+            pending_.clear();
+        }
+        cv_.notify_all();
+        return ok;
+    }
+
+    // A worker exits.
+    void Done() {
+        if(--running_ == 0) {
+            out_->Close();
+        }
+    }
+
+private:
+    SharedChan<_SharedBatch<T>> out_;
+
+    std::atomic<int> running_;
+
+    size_t window_;
+
+    std::mutex mu_;
+
+    std::condition_variable cv_;
+
+    // The sequence of the next batch to hand off.
+    uint64_t next_;
+
+    // The reorder buffer.
+    std::map<uint64_t, _SharedBatch<T>> pending_;
+
+    bool stopped_;
+};
+
+// A Pipeline chains stages of worker threads over channels, replacing the hand-written plumbing
+// of a producer, N workers and a merger:
+//
+//     SharedChan<int> out = Pipeline<int>(src).Map(f, 4).Filter(g).Merge();
+//
+// Elements travel between stages in batches of up to Batch() elements, so a channel operation
+// is paid per batch, not per element. A batch is flushed early when the source has nothing ready,
+// so a slow source does not add latency.
+// Each stage closes its output once all of its workers have exited, and a stage whose output
+// has been closed by the consumer closes its input, so the upstream stages stop too.
+// By default the workers of a stage emit batches as they finish them, Ordered() keeps the order of the source.
+// Like a std::thread, an exception escaping a stage function terminates the process.
+template <typename T>
+class Pipeline {
+public:
+    template <typename U>
+    friend class Pipeline;
+
+    // Read the elements of `src` until it is closed.
+    explicit Pipeline(const SharedChan<T>& src) : src_(src), batch_(64), window_(0) {}
+
+    // Move up to `n` elements per batch. It must be called before the first stage.
+    Pipeline& Batch(size_t n) {
+        _Configure();
+        batch_ = n < 1 ? 1 : n;
+        return *this;
+    }
+
+    // Keep the order of the source through all stages,
+    // with at most `window` finished batches per stage waiting for an earlier one.
+    // It must be called before the first stage, which would reorder the batches otherwise.
+    Pipeline& Ordered(size_t window = 16) {
+        _Configure();
+        window_ = window < 1 ? 1 : window;
+        return *this;
+    }
+
+    // Transform every element by `f` in `workers` threads.
+    template <typename F>
+    Pipeline<typename std::decay<decltype(std::declval<F&>()(std::declval<const T&>()))>::type>
+    Map(F f, int workers = 1) {
+        typedef typename std::decay<decltype(std::declval<F&>()(std::declval<const T&>()))>::type U;
+        return Pipeline<U>(_Stage<U>([f](const std::vector<T>& in, std::vector<U>* out) mutable {
+            for(const T& v : in) {
+                out->push_back(f(v));
+            }
+        }, workers), batch_, window_);
+    }
+
+    // Keep the elements for which `f` returns true, in `workers` threads.
+    template <typename F>
+    Pipeline<T> Filter(F f, int workers = 1) {
+        return Pipeline<T>(_Stage<T>([f](const std::vector<T>& in, std::vector<T>* out) mutable {
+            for(const T& v : in) {
+                if(f(v)) {
+                    out->push_back(v);
+                }
+            }
+        }, workers), batch_, window_);
+    }
+
+    // Unpack the batches into a channel of `len` elements, closed at the end of the stream.
+    // If the consumer closes it, the whole pipeline stops.
+    SharedChan<T> Merge(int len = 0) {
+        SharedChan<_SharedBatch<T>> in = _Batches();
+        SharedChan<T> out = MakeChan<T>(len > 0 ? len : static_cast<int>(batch_));
+        std::thread([in, out]() {
+            _SharedBatch<T> b;
+            while(in->Pop(&b)) {
+                for(const T& v : b->items) {
+                    if(!out->Push(v)) {
+                        in->Close();
+                        return;
+                    }
+                }
+            }
+            out->Close();
+        }).detach();
+        return out;
+    }
+
+private:
+    Pipeline(const SharedChan<_SharedBatch<T>>& in, size_t batch, size_t window)
+            : in_(in), batch_(batch), window_(window) {}
+
+    // A pipeline continued from a stage cannot be configured any more.
+    void _Configure() {
+        if(in_ != nullptr) {
+            throw std::logic_error("Pipeline must be configured before the first stage.");
+        }
+    }
+
+    // Return the batches of the stream, starting the batching of the source at the first stage.
+    SharedChan<_SharedBatch<T>> _Batches() {
+        if(in_ == nullptr) {
+            in_ = MakeChan<_SharedBatch<T>>(2);
+            SharedChan<T> src = src_;
+            SharedChan<_SharedBatch<T>> out = in_;
+            size_t n = batch_;
+            std::thread([src, out, n]() {
+                uint64_t seq = 0;
+                _SharedBatch<T> b = _NewBatch<T>(seq, n);
+                while(1) {
+                    T v;
+                    int res = b->items.empty() ? src->Pop(&v) : src->TryPop(&v);
+                    if(res == 1) {
+                        b->items.push_back(std::move(v));
+                        if(b->items.size() < n) {
+                            continue;
+                        }
+                    } else if(b->items.empty()) {   // closed and empty
+                        break;
+                    }
+                    // flush when the batch is full, nothing is ready or the source is closed
+                    if(!out->Push(b) || res == -1) {
+                        break;
+                    }
+                    b = _NewBatch<T>(++seq, n);
+                }
+                out->Close();
+            }).detach();
+            src_.reset();
+        }
+        return in_;
+    }
+
+    // Run `workers` threads applying `f` to the batches into the batches of a new channel.
+    template <typename U, typename F>
+    SharedChan<_SharedBatch<U>> _Stage(F f, int workers) {
+        if(workers < 1) {
+            workers = 1;
+        }
+        SharedChan<_SharedBatch<T>> in = _Batches();
+        SharedChan<_SharedBatch<U>> out = MakeChan<_SharedBatch<U>>(2 * workers);
+        std::shared_ptr<_StageOut<U>> stage = std::make_shared<_StageOut<U>>(out, workers, window_);
+        size_t n = batch_;
+        for(int i = 0; i < workers; i++) {
+            std::thread([in, stage, f, n]() mutable {
+                _SharedBatch<T> b;
+                while(in->Pop(&b)) {
+                    _SharedBatch<U> o = _NewBatch<U>(b->seq, n);
+                    f(b->items, &o->items);
+                    if(!stage->Emit(o)) {
+                        in->Close();
+                        break;
+                    }
+                }
+                stage->Done();
+            }).detach();
+        }
+        return out;
+    }
+
+    // The source, until the first stage starts batching it.
+    SharedChan<T> src_;
+
+    // The batches of the stream.
+    SharedChan<_SharedBatch<T>> in_;
+
+    size_t batch_;
+
+    // The reorder window of the next stages, 0 if unordered.
+    size_t window_;
+};
+
+}
+
+#endif //RTDSYNC_PIPELINE_H
@@ -0,0 +1,355 @@
+#ifndef RTDSYNC_POOL_H
+#define RTDSYNC_POOL_H
+
+#include <mutex>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <new>
+#include <cstddef>
+
+namespace rtd {
+
+// Return a small index of the calling thread, assigned round robin on its first call.
+inline size_t _ThreadSlot() {
+    static std::atomic<size_t> next(0);
+    static thread_local size_t slot = next.fetch_add(1);
+    return slot;
+}
+
+// A Pool caches allocated but unused objects for later reuse, inspired by Golang sync.Pool.
+// Threads are spread over mutex-guarded shards, twice as many as the cores, by the order they first use a pool,
+// so Get() and Put() rarely contend, but threads beyond the shard count share a shard and its lock.
+// A shard refills from, and spills into, the shared list in batches of half its capacity.
+// Sweep() moves the cached objects to a victim list, and frees the previous victims,
+// as Golang does on every garbage collection.
+// The pool does not reset objects, a caller of Get() must not assume their state.
+template <typename T>
+class Pool {
+    typedef std::lock_guard<std::mutex> guard;
+
+public:
+    // `newFunc` creates an object when the pool is empty, `new T()` by default.
+    // `localCap` is the capacity of each shard.
+    explicit Pool(std::function<T*()> newFunc = nullptr, size_t localCap = 64)
+        : new_(newFunc), cap_(localCap < 2 ? 2 : localCap) {
+        size_t n = 1;
+        size_t cores = std::thread::hardware_concurrency();
+        while(n < 2 * cores) {
+            n <<= 1;
+        }
+        shards_ = new _Shard[n];
+        mask_ = n - 1;
+        for(size_t i = 0; i < n; i++) {
+            shards_[i].items.reserve(cap_);
+        }
+        sharedCap_ = cap_ * n;
+    }
+
+    Pool(const Pool&) = delete;
+    Pool& operator=(const Pool&) = delete;
+
+    ~Pool() {
+        for(size_t i = 0; i <= mask_; i++) {
+            _Free(shards_[i].items);
+        }
+        _Free(shared_);
+        _Free(victim_);
+        delete [] shards_;
+    }
+
+    // Take an object from the pool, or create one if the pool is empty.
+    T* Get() {
+        _Shard& s = shards_[_ThreadSlot() & mask_];
+        {
+            guard lc(s.mu);
+            if(!s.items.empty() || _Refill(s.items)) {
+                T* x = s.items.back();
+                s.items.pop_back();
+                return x;
+            }
+        }
+        return new_ ? new_() : new T();
+    }
+
+    // Put an object back to the pool.
+    void Put(T* x) {
+        if(x == nullptr) {
+            return;
+        }
+        _Shard& s = shards_[_ThreadSlot() & mask_];
+        guard lc(s.mu);
+        if(s.items.size() >= cap_) {
+            _Spill(s.items);
+        }
+        s.items.push_back(x);
+    }
+
+    // Move all cached objects to the victim list, and free the previous victims.
+    // An object survives one Sweep() if it is not taken, and is freed by the next one.
+    void Sweep() {
+        std::vector<T*> victim;
+        for(size_t i = 0; i <= mask_; i++) {
+            guard lc(shards_[i].mu);
+            victim.insert(victim.end(), shards_[i].items.begin(), shards_[i].items.end());
+            shards_[i].items.clear();
+        }
+        {
+            guard lc(mu_);
+            victim.insert(victim.end(), shared_.begin(), shared_.end());
+            shared_.clear();
+            victim_.swap(victim);
+        }
+        _Free(victim);
+    }
+
+private:
+    struct _Shard {
+        std::mutex mu;
+        std::vector<T*> items;
+        char pad[64];   // keep shards of different threads on different cache lines
+    };
+
+    // Move a batch from the shared list, or the victim list, into a shard.
+    bool _Refill(std::vector<T*>& items) {
+        guard lc(mu_);
+        std::vector<T*>& from = shared_.empty() ? victim_ : shared_;
+        size_t n = std::min(cap_ / 2, from.size());
+        items.insert(items.end(), from.end() - n, from.end());
+        from.resize(from.size() - n);
+        return n > 0;
+    }
+
+    // Move half of a full shard into the shared list, and free the objects beyond its capacity.
+    void _Spill(std::vector<T*>& items) {
+        size_t n = cap_ / 2;
+        std::vector<T*> excess;
+        {
+            guard lc(mu_);
+            shared_.insert(shared_.end(), items.end() - n, items.end());
+            if(shared_.size() > sharedCap_) {
+                excess.assign(shared_.begin() + sharedCap_, shared_.end());
+                shared_.resize(sharedCap_);
+            }
+        }
+        items.resize(items.size() - n);
+        _Free(excess);
+    }
+
+    static void _Free(std::vector<T*>& items) {
+        for(T* x : items) {
+            delete x;
+        }
+        items.clear();
+    }
+
+    std::function<T*()> new_;
+
+    size_t cap_;
+
+    _Shard* shards_;
+
+    size_t mask_;
+
+    std::mutex mu_;
+
+    std::vector<T*> shared_;
+
+    size_t sharedCap_;
+
+    std::vector<T*> victim_;
+};
+
+// Round a size up to its size class.
+constexpr size_t _SizeClass(size_t size) {
+    return (size + 15) & ~static_cast<size_t>(15);
+}
+
+// A free block, linked through its own memory.
+struct _FreeBlock {
+    _FreeBlock* next;
+};
+
+// The number of blocks moved between a thread cache and the depot at once.
+constexpr size_t _blockBatch = 32;
+
+// The batches of free blocks of a size class spilled by the thread caches, shared by all threads.
+// A thread only locks it once per `_blockBatch` blocks, when its cache runs empty or full.
+// It is never destroyed, so that blocks can still be freed in static destructors.
+template <size_t Size>
+class _BlockDepot {
+    typedef std::lock_guard<std::mutex> guard;
+
+public:
+    static _BlockDepot& Get() {
+        static _BlockDepot* depot = new _BlockDepot();
+        return *depot;
+    }
+
+    // Take a batch of `_blockBatch` blocks, or return nullptr.
+    _FreeBlock* Take() {
+        guard lc(mu_);
+        if(batches_.empty()) {
+            return nullptr;
+        }
+        _FreeBlock* b = batches_.back();
+        batches_.pop_back();
+        return b;
+    }
+
+    // Keep a batch of `_blockBatch` blocks, or free it if the depot is full.
+    void Give(_FreeBlock* b) {
+        {
+            guard lc(mu_);
+            if(batches_.size() < maxBatches_) {
+                batches_.push_back(b);
+                return;
+            }
+        }
+        _Free(b);
+    }
+
+    // Free a list of blocks.
+    static void _Free(_FreeBlock* b) {
+        while(b != nullptr) {
+            _FreeBlock* next = b->next;
+            ::operator delete(b);
+            b = next;
+        }
+    }
+
+private:
+    _BlockDepot() {
+        size_t cores = std::thread::hardware_concurrency();
+        maxBatches_ = 64 * (cores < 1 ? 1 : cores);
+    }
+
+    std::mutex mu_;
+
+    std::vector<_FreeBlock*> batches_;
+
+    size_t maxBatches_;
+};
+
+// The free blocks of a size class cached by a thread, a plain list without locks or atomics.
+// It holds up to two batches: a full cache spills one batch into the depot, an empty one takes a batch back.
+// The blocks are returned to the depot when the thread exits.
+template <size_t Size>
+struct _BlockCache {
+    _BlockCache() : head(nullptr), count(0) {}
+
+    ~_BlockCache() {
+        _Exited() = true;
+        while(count >= _blockBatch) {
+            _BlockDepot<Size>::Get().Give(_Detach());
+        }
+        _BlockDepot<Size>::_Free(head);
+    }
+
+    void* Get() {
+        if(head == nullptr) {
+            head = _BlockDepot<Size>::Get().Take();
+            if(head == nullptr) {
+                return ::operator new(Size);
+            }
+            count = _blockBatch;
+        }
+        _FreeBlock* b = head;
+        head = b->next;
+        --count;
+        return b;
+    }
+
+    void Put(void* p) {
+        _FreeBlock* b = static_cast<_FreeBlock*>(p);
+        b->next = head;
+        head = b;
+        if(++count > 2 * _blockBatch) {
+            _BlockDepot<Size>::Get().Give(_Detach());
+        }
+    }
+
+    // Unlink a batch from the head of the list.
+    _FreeBlock* _Detach() {
+        _FreeBlock* first = head;
+        _FreeBlock* last = head;
+        for(size_t i = 1; i < _blockBatch; i++) {
+            last = last->next;
+        }
+        head = last->next;
+        last->next = nullptr;
+        count -= _blockBatch;
+        return first;
+    }
+
+    // Whether the cache of the calling thread has been destroyed, by the exit of the thread.
+    static bool& _Exited() {
+        static thread_local bool exited = false;
+        return exited;
+    }
+
+    _FreeBlock* head;
+
+    size_t count;
+};
+
+// Return the block cache of a size class of the calling thread,
+// or nullptr while the thread is exiting and its cache has been destroyed.
+template <size_t Size>
+inline _BlockCache<Size>* _LocalBlocks() {
+    if(_BlockCache<Size>::_Exited()) {
+        return nullptr;
+    }
+    static thread_local _BlockCache<Size> cache;
+    return &cache;
+}
+
+// An allocator taking single objects from the block cache of the calling thread,
+// for the nodes of containers and the control blocks of std::allocate_shared.
+// Allocating and freeing touch no lock or atomic, except once per batch of blocks moved to or from the depot.
+// Blocks come from operator new, so a block may be freed by any thread.
+// Arrays and over-aligned types fall back to operator new.
+template <typename T>
+struct PoolAllocator {
+    typedef T value_type;
+
+    PoolAllocator() noexcept {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n) {
+        if(n == 1 && alignof(T) <= alignof(std::max_align_t)) {
+            _BlockCache<_SizeClass(sizeof(T))>* c = _LocalBlocks<_SizeClass(sizeof(T))>();
+            return static_cast<T*>(c != nullptr ? c->Get() : ::operator new(_SizeClass(sizeof(T))));
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n) {
+        if(n == 1 && alignof(T) <= alignof(std::max_align_t)) {
+            _BlockCache<_SizeClass(sizeof(T))>* c = _LocalBlocks<_SizeClass(sizeof(T))>();
+            if(c != nullptr) {
+                c->Put(p);
+                return;
+            }
+        }
+        ::operator delete(p);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const PoolAllocator<T>&, const PoolAllocator<U>&) {
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const PoolAllocator<T>&, const PoolAllocator<U>&) {
+    return false;
+}
+
+}
+
+#endif //RTDSYNC_POOL_H
@@ -0,0 +1,139 @@
+#ifndef RTDSYNC_RATE_H
+#define RTDSYNC_RATE_H
+
+#include "context.h"
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+
+namespace rtd {
+
+// A RateLimiter allows events up to a rate with bursts, inspired by Golang x/time/rate.
+// It is a token bucket refilling `rate` tokens per second up to `burst` tokens,
+// implemented as the generic cell rate algorithm: instead of counting tokens,
+// it keeps the theoretical arrival time (TAT) of the next event, and tokens are computed lazily from it.
+// A permit costs one load and one CAS of the TAT, no lock and no timer.
+// Only Wait() uses the timers heap, to sleep until its permits are due.
+class RateLimiter {
+public:
+    // `rate` is the number of tokens per second, `burst` is the capacity of the bucket.
+    RateLimiter(double rate, int burst) : burst_(burst < 1 ? 1 : burst), tat_(0) {
+        if(rate <= 0) {
+            throw std::logic_error("rate of limiter must be positive.");
+        }
+        interval_ = static_cast<int64_t>(1e9 / rate);
+        if(interval_ < 1) {
+            interval_ = 1;
+        }
+    }
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    // Take `n` tokens if they are available now.
+    // Return false without taking any token if not.
+    bool Allow(int n = 1) {
+        int64_t now = _Now();
+        int64_t tat = tat_.load();
+        while(1) {
+            int64_t next = (tat > now ? tat : now) + n * interval_;
+            if(next - now > burst_ * interval_) {
+                return false;
+            }
+            if(tat_.compare_exchange_weak(tat, next)) {
+                return true;
+            }
+        }
+    }
+
+    // Take `n` tokens ahead of time.
+    // Return how long the caller should wait before acting, zero if the tokens are available now.
+    // Throw a logic_error if `n` exceeds the burst, since the tokens would never be available.
+    time::nanoseconds Reserve(int n = 1) {
+        if(n > burst_) {
+            throw std::logic_error("tokens to reserve exceed the burst of limiter.");
+        }
+        int64_t now = _Now();
+        int64_t tat = tat_.load();
+        int64_t next;
+        do {
+            next = (tat > now ? tat : now) + n * interval_;
+        } while(!tat_.compare_exchange_weak(tat, next));
+        int64_t delay = next - now - burst_ * interval_;
+        return time::nanoseconds(delay > 0 ? delay : 0);
+    }
+
+    // Take `n` tokens, blocking until they are available.
+    void Wait(int n = 1) {
+        time::nanoseconds delay = Reserve(n);
+        if(delay.count() > 0) {
+            time::Timer<int64_t, std::nano> t(delay);
+            t.Start();
+            t.Channel()->Pop(nullptr);
+        }
+    }
+
+    // Take `n` tokens, blocking until they are available, or give up when `ctx` is done.
+    // It gives up at once if the tokens are due after the deadline of `ctx`.
+    // Return 1 if success, return -3 if ctx is done, and the tokens are given back.
+    int Wait(int n, const SharedContext& ctx) {
+        if(ctx->IsDone()) {
+            return -3;
+        }
+        time::nanoseconds delay = Reserve(n);
+        if(delay.count() <= 0) {
+            return 1;
+        }
+        time::MonoTimePoint d;
+        if(ctx->Deadline(&d) && time::MonoNow() + delay > d) {
+            _Cancel(n);
+            return -3;
+        }
+        time::Timer<int64_t, std::nano> t(delay);
+        t.Start();
+        if(t.Channel()->Pop(nullptr, ctx) == -3) {
+            t.Stop();
+            _Cancel(n);
+            return -3;
+        }
+        return 1;
+    }
+
+    // Return the number of tokens available now, negative if tokens have been reserved ahead of time.
+    double Tokens() {
+        int64_t now = _Now();
+        int64_t tat = tat_.load();
+        return static_cast<double>(burst_ * interval_ - (tat > now ? tat - now : 0)) / interval_;
+    }
+
+private:
+    static int64_t _Now() {
+        return time::duration_cast<time::nanoseconds>(time::MonoNow().time_since_epoch()).count();
+    }
+
+    // Give back `n` reserved tokens. Tokens that have been refilled since are not given back twice.
+    void _Cancel(int n) {
+        int64_t now = _Now();
+        int64_t tat = tat_.load();
+        int64_t prev;
+        do {
+            prev = tat - n * interval_;
+            if(prev < now) {
+                prev = now;
+            }
+        } while(!tat_.compare_exchange_weak(tat, prev));
+    }
+
+    int64_t burst_;
+
+    // The nanoseconds to refill one token.
+    int64_t interval_;
+
+    // The theoretical arrival time in nanoseconds of the monotonic clock.
+    // The bucket is full when it is not later than now.
+    std::atomic<int64_t> tat_;
+};
+
+}
+
+#endif //RTDSYNC_RATE_H
@@ -5,6 +5,10 @@
 #include <atomic>
 #include <chrono>
 #include <stdexcept>
+#include <mutex>
+#include <cstdint>
+#include "select.h"
+#include "stats.h"
 
 namespace rtd {
 
@@ -19,7 +23,7 @@ struct _node {
     explicit _node(size_t position): pos(position) {}
 };
 
-size_t roundUp(size_t v) {
+inline size_t roundUp(size_t v) {
     v--;
     v |= v >> 1;
     v |= v >> 2;
@@ -43,6 +47,8 @@ public:
         dequeue_ = 0;
         queue_ = 0;
         disposed_ = false;
+        watching_ = 0;
+        RTDSYNC_STAT(stats_.cap = cap_);
     }
 
     bool Put(T v) {
@@ -60,6 +66,7 @@ public:
                 if (queue_.compare_exchange_weak(pos, pos + 1)) {
                     break;
                 }
+                RTDSYNC_STAT(_StatsInc(stats_.putRetries));
             } else if(diff < 0) {
                 throw std::runtime_error("Putting operation in compromised state.");
             } else {
@@ -69,13 +76,44 @@ public:
 
         n->data = v;
         n->pos = pos + 1;
+        RTDSYNC_STAT(_StatsInc(stats_.puts));
+        _Notify();
         return true;
     }
 
+    // Put an element in non-blocking.
+    // Return 1 if success, return 0 if filled, return -1 if disposed.
+    int TryPut(const T& v) {
+        _node<T>* n;
+        size_t pos = queue_;
+        for(;;) {
+            if(disposed_) {
+                return -1;
+            }
+            n = &buf_[pos&mask_];
+            intptr_t diff = static_cast<intptr_t>(n->pos - pos);
+            if(diff == 0) {
+                if (queue_.compare_exchange_weak(pos, pos + 1)) {
+                    break;
+                }
+                RTDSYNC_STAT(_StatsInc(stats_.putRetries));
+            } else if(diff < 0) {   // the slot has not been got a lap ago
+                return 0;
+            } else {
+                pos = queue_;
+            }
+        }
+        n->data = v;
+        n->pos = pos + 1;
+        RTDSYNC_STAT(_StatsInc(stats_.puts));
+        _Notify();
+        return 1;
+    }
+
     bool Get(T* data, milliseconds timeout=milliseconds(0)) {
         _node<T>* n;
         size_t pos = dequeue_;
-        SysTimePoint start = system_clock::now();
+        auto start = steady_clock::now();
 
         for(;;) {
             if(disposed_) {
@@ -89,24 +127,69 @@ public:
                 if(dequeue_.compare_exchange_weak(pos, pos + 1)) {
                     break;
                 }
+                RTDSYNC_STAT(_StatsInc(stats_.getRetries));
             } else if(diff < 0) {
                 throw std::runtime_error("Getting operation in compromised state.");
             } else {
                 pos = dequeue_;
             }
 
-            auto end = system_clock::now();
+            auto end = steady_clock::now();
             if(timeout > milliseconds(0) && timeout <= duration_cast<milliseconds>(end - start)){
                 return false;
             }
         }
         *data = n->data;
         n->pos = pos + mask_ + 1;
+        RTDSYNC_STAT(_StatsInc(stats_.gets));
+        _Notify();
         return true;
     }
 
+    // Get an element in non-blocking.
+    // Return 1 if success, return 0 if empty, return -1 if disposed.
+    int TryGet(T* data) {
+        _node<T>* n;
+        size_t pos = dequeue_;
+        for(;;) {
+            if(disposed_) {
+                return -1;
+            }
+            n = &buf_[pos&mask_];
+            intptr_t diff = static_cast<intptr_t>(n->pos - (pos + 1));
+            if(diff == 0) {
+                if(dequeue_.compare_exchange_weak(pos, pos + 1)) {
+                    break;
+                }
+                RTDSYNC_STAT(_StatsInc(stats_.getRetries));
+            } else if(diff < 0) {   // the slot has not been put yet
+                return 0;
+            } else {
+                pos = dequeue_;
+            }
+        }
+        if(data != nullptr) {
+            *data = n->data;
+        }
+        n->pos = pos + mask_ + 1;
+        RTDSYNC_STAT(_StatsInc(stats_.gets));
+        _Notify();
+        return 1;
+    }
+
+    // The case of Select() putting `v`.
+    SelectCase PutCase(const T& v) {
+        return SelectCase { [this, v]() -> int { return TryPut(v); }, this, &RingBuffer::_Watch, &RingBuffer::_Unwatch };
+    }
+
+    // The case of Select() getting into `v`.
+    SelectCase GetCase(T* v) {
+        return SelectCase { [this, v]() -> int { return TryGet(v); }, this, &RingBuffer::_Watch, &RingBuffer::_Unwatch };
+    }
+
     void Dispose() {
         disposed_ = true;
+        _Notify();
     }
 
     bool IsDisposed() {
@@ -126,12 +209,43 @@ public:
     }
 
 private:
+    // Wake the Select() calls watching the buffer, after a put, a get or Dispose().
+    // Nothing is locked on the lock-free path unless somebody watches.
+    void _Notify() {
+        if(watching_.load() != 0) {     // ordered after the update of the slot, see _Watch()
+            std::lock_guard<std::mutex> lc(mu_);
+            watchers_.WakeAll();
+        }
+    }
+
+    // The watcher is counted before Select() polls the buffer,
+    // so either the poll sees an update, or the update sees the watcher.
+    static void _Watch(void* r, _Waiter* w) {
+        RingBuffer* rb = static_cast<RingBuffer*>(r);
+        rb->watching_.fetch_add(1);
+        std::lock_guard<std::mutex> lc(rb->mu_);
+        rb->watchers_.Add(w);
+    }
+
+    static void _Unwatch(void* r, _Waiter* w) {
+        RingBuffer* rb = static_cast<RingBuffer*>(r);
+        {
+            std::lock_guard<std::mutex> lc(rb->mu_);
+            rb->watchers_.Remove(w);
+        }
+        rb->watching_.fetch_sub(1);
+    }
+
     _node<T>* buf_;
     size_t cap_;
     size_t mask_;
     std::atomic<bool> disposed_;
     std::atomic<size_t> queue_;
     std::atomic<size_t> dequeue_;
+    std::mutex mu_;
+    _WaitList watchers_;
+    std::atomic<int> watching_;
+    RTDSYNC_STAT(_RingBufferStats stats_{this});
 };
 }
 
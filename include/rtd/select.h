@@ -0,0 +1,202 @@
+#ifndef RTDSYNC_SELECT_H
+#define RTDSYNC_SELECT_H
+
+#include <functional>
+#include <initializer_list>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include "notify.h"
+#include "sema.h"
+#include "trace.h"
+
+namespace rtd {
+
+// Try an operation without blocking.
+// Return 1 if success, 0 if it would block, -1 if it never succeeds any more, such as on a closed channel.
+using TryState = std::function<int(void)>;
+
+// A case of Select(), an operation on an object that can be waited on:
+// its TryState, and how to watch `obj` for a change that may make the TryState succeed.
+// A watcher is woken with the lock of the object held, so its wake function must not block.
+// Channels, RingBuffer, Timer and WaitGroup make cases, such as `ch->PopCase(&v)` or `wg->DoneCase()`,
+// so one Select() can park on any mix of them.
+// `watch` and `unwatch` are null for a case that can only be polled, like a plain TryState function.
+struct SelectCase {
+    TryState func;
+    void* obj;
+    void (*watch)(void* obj, _Waiter* w);
+    void (*unwatch)(void* obj, _Waiter* w);
+
+    // A case can be mixed with plain TryState functions, in a Select() that polls.
+    operator TryState() const {
+        return func;
+    }
+};
+
+struct SelectOp {
+    int index;
+    TryState func;
+};
+
+struct _SelectCaseOp {
+    int index;
+    SelectCase c;
+};
+
+inline std::vector<_SelectCaseOp> _SelectCases(const std::initializer_list<SelectCase>& args) {
+    std::vector<_SelectCaseOp> ops;
+    int i = 0;
+    for(const SelectCase& c : args) {
+        ops.push_back(_SelectCaseOp { i++, c });
+    }
+    std::random_shuffle(ops.begin(), ops.end());
+    return ops;
+}
+
+// Wrap TryState functions into cases that cannot be watched.
+inline std::vector<_SelectCaseOp> _SelectCases(const std::initializer_list<TryState>& args) {
+    std::vector<_SelectCaseOp> ops;
+    int i = 0;
+    for(const TryState& f : args) {
+        ops.push_back(_SelectCaseOp { i++, SelectCase { f, nullptr, nullptr, nullptr } });
+    }
+    std::random_shuffle(ops.begin(), ops.end());
+    return ops;
+}
+
+// Poll the cases once.
+// Return the index of the first case whose TryState returns 1, -1 if all of them return -1, or -2.
+inline int _PollCases(std::vector<_SelectCaseOp>& ops) {
+    size_t closed_num = 0;
+    for(_SelectCaseOp& op : ops) {
+        int result = op.c.func();
+        if(result == 1) {
+            RTDSYNC_TRACE_DO(_Trace(TraceEvent::select, nullptr, op.index));
+            return op.index;
+        } else if(result == -1) {
+            ++closed_num;
+        }
+    }
+    return closed_num == ops.size() ? -1 : -2;
+}
+
+// A thread parked on the objects of the cases, woken when any of them changes.
+// It watches them from construction to destruction, so a change after a poll is not missed.
+// If a case cannot be watched, it also wakes by itself to poll again, after a backoff growing up to 1ms.
+class _SelectParker {
+public:
+    explicit _SelectParker(std::vector<_SelectCaseOp>& ops) : ops_(ops), watchers_(ops.size()), polled_(false),
+            changed_(false) {
+        for(size_t i = 0; i < ops_.size(); i++) {
+            if(ops_[i].c.watch == nullptr) {
+                polled_ = true;
+                continue;
+            }
+            watchers_[i].arg = this;
+            watchers_[i].wake = &_SelectParker::_Wake;
+            ops_[i].c.watch(ops_[i].c.obj, &watchers_[i]);
+        }
+        extra_.arg = this;
+        extra_.wake = &_SelectParker::_Wake;
+    }
+
+    _SelectParker(const _SelectParker&) = delete;
+    _SelectParker& operator=(const _SelectParker&) = delete;
+
+    // Once the watchers are removed, nobody touches the parker.
+    ~_SelectParker() {
+        for(size_t i = 0; i < ops_.size(); i++) {
+            if(ops_[i].c.watch != nullptr) {
+                ops_[i].c.unwatch(ops_[i].c.obj, &watchers_[i]);
+            }
+        }
+    }
+
+    // Poll the cases, and park until any of them changes if none is ready.
+    // Return the index, -1 when all of them are closed, or -3 when `done(arg)` returns true,
+    // which is checked before every poll.
+    int Select(bool (*done)(void* arg) = nullptr, void* arg = nullptr) {
+        std::chrono::nanoseconds backoff(1000);
+        while(1) {
+            changed_ = false;
+            if(done != nullptr && done(arg)) {
+                return -3;
+            }
+            int res = _PollCases(ops_);
+            if(res != -2) {
+                return res;
+            }
+            if(!polled_) {
+                sema_.Acquire();
+                continue;
+            }
+            sema_.AcquireFor(backoff);
+            if(backoff < std::chrono::milliseconds(1)) {
+                backoff *= 2;
+            }
+        }
+    }
+
+    // A waiter waking the parker, for anything else that Select() should check, like a context.
+    _Waiter* Extra() {
+        return &extra_;
+    }
+
+private:
+    static void _Wake(_Waiter* w) {
+        _SelectParker* p = static_cast<_SelectParker*>(w->arg);
+        if(!p->changed_.exchange(true)) {
+            p->sema_.Release();
+        }
+    }
+
+    std::vector<_SelectCaseOp>& ops_;
+
+    std::vector<_Waiter> watchers_;
+
+    _Waiter extra_;
+
+    // Whether any case cannot be watched, so it has to be polled.
+    bool polled_;
+
+    // Whether it has been woken since the last poll, so a burst of changes releases the sema once.
+    std::atomic<bool> changed_;
+
+    _Sema sema_;
+};
+
+// Listening mutli channels by select.
+// select will poll channels to call its TryState function.
+// Return a channel index when its TryState function return 1.
+// Return -1 when all channels were closed.
+// Return -2 when `use_default` is true in one loop if no channel returns.
+inline int Select(const std::initializer_list<TryState> args, bool use_default = false) {
+    std::vector<_SelectCaseOp> ops = _SelectCases(args);
+    while(1) {
+        int res = _PollCases(ops);
+        if(res != -2 || use_default) {
+            return res;
+        }
+    }
+}
+
+// Listening multi objects by select, like the Select() of TryState functions,
+// but the thread is parked on all of the objects until one of them changes, instead of polling them.
+// Return a case index when its operation succeeds.
+// Return -1 when all cases never succeed any more, such as on closed channels.
+// Return -2 when `use_default` is true and no case is ready.
+inline int Select(const std::initializer_list<SelectCase> args, bool use_default = false) {
+    std::vector<_SelectCaseOp> ops = _SelectCases(args);
+    int res = _PollCases(ops);
+    if(res != -2 || use_default) {
+        return res;
+    }
+    _SelectParker p(ops);
+    return p.Select();
+}
+
+}
+
+#endif //RTDSYNC_SELECT_H
@@ -0,0 +1,117 @@
+#ifndef RTDSYNC_SEMA_H
+#define RTDSYNC_SEMA_H
+
+#include <atomic>
+#include <cstdint>
+#include <chrono>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <ctime>
+#else
+#include <mutex>
+#include <condition_variable>
+#endif
+
+namespace rtd {
+
+// Internal counting semaphore, used to park threads in the slow path of the primitives.
+// Release() never blocks, and it does not make a syscall if nobody is waiting.
+// It is backed by a futex on Linux, and by a condition variable elsewhere.
+class _Sema {
+public:
+    _Sema() : count_(0), waiters_(0) {}
+
+    _Sema(const _Sema&) = delete;
+    _Sema& operator=(const _Sema&) = delete;
+
+    // Blocking until the count is positive, and decrease it.
+    void Acquire() {
+        if(_TryAcquire()) {
+            return;
+        }
+        waiters_.fetch_add(1);
+#if defined(__linux__)
+        while(!_TryAcquire()) {
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&count_), FUTEX_WAIT_PRIVATE, 0, nullptr, nullptr, 0);
+        }
+#else
+        {
+            std::unique_lock<std::mutex> lc(mu_);
+            cv_.wait(lc, [&]() { return _TryAcquire(); });
+        }
+#endif
+        waiters_.fetch_sub(1);
+    }
+
+    // Like Acquire(), but give up after `timeout`.
+    // Return false if it timed out.
+    bool AcquireFor(std::chrono::nanoseconds timeout) {
+        if(_TryAcquire()) {
+            return true;
+        }
+        bool ok = true;
+        waiters_.fetch_add(1);
+#if defined(__linux__)
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while(!_TryAcquire()) {
+            auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now());
+            if(left.count() <= 0) {
+                ok = false;
+                break;
+            }
+            struct timespec ts;     // FUTEX_WAIT takes a relative timeout
+            ts.tv_sec = static_cast<time_t>(left.count() / 1000000000);
+            ts.tv_nsec = static_cast<long>(left.count() % 1000000000);
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&count_), FUTEX_WAIT_PRIVATE, 0, &ts, nullptr, 0);
+        }
+#else
+        {
+            std::unique_lock<std::mutex> lc(mu_);
+            ok = cv_.wait_for(lc, timeout, [&]() { return _TryAcquire(); });
+        }
+#endif
+        waiters_.fetch_sub(1);
+        return ok;
+    }
+
+    // Increase the count by `n`, and wake up to `n` waiters.
+    void Release(uint32_t n = 1) {
+        count_.fetch_add(n);
+        if(waiters_.load() == 0) {
+            return;
+        }
+#if defined(__linux__)
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&count_), FUTEX_WAKE_PRIVATE, n, nullptr, nullptr, 0);
+#else
+        std::lock_guard<std::mutex> lc(mu_);
+        cv_.notify_all();
+#endif
+    }
+
+private:
+    bool _TryAcquire() {
+        uint32_t c = count_.load();
+        while(c > 0) {
+            if(count_.compare_exchange_weak(c, c - 1)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::atomic<uint32_t> count_;
+
+    std::atomic<uint32_t> waiters_;
+
+#if !defined(__linux__)
+    std::mutex mu_;
+    std::condition_variable cv_;
+#endif
+};
+
+}
+
+#endif //RTDSYNC_SEMA_H
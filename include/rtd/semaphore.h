@@ -0,0 +1,185 @@
+#ifndef RTDSYNC_SEMAPHORE_H
+#define RTDSYNC_SEMAPHORE_H
+
+#include "context.h"
+#include "notify.h"
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <stdexcept>
+
+namespace rtd {
+
+// A Semaphore is a weighted counting semaphore, inspired by Golang x/sync/semaphore.
+// It bounds a resource of `size` units, and a caller acquires and releases any number of them at once.
+// The available units and whether anybody waits are packed into one atomic,
+// so Acquire() and Release() are a single CAS while nobody waits.
+// Waiters are served in FIFO order: a large request at the front is not starved by smaller ones
+// arriving later, which wait behind it even if there are enough units for them.
+class Semaphore {
+    typedef std::unique_lock<std::mutex> lock;
+
+public:
+    explicit Semaphore(int64_t size) : size_(size < 0 ? 0 : size), state_(size_ << 1) {}
+
+    Semaphore(const Semaphore&) = delete;
+    Semaphore& operator=(const Semaphore&) = delete;
+
+    // Acquire `n` units, blocking until they are available.
+    // Throw a logic_error if `n` exceeds the size, since the units would never be available.
+    void Acquire(int64_t n = 1) {
+        if(n > size_) {
+            throw std::logic_error("units to acquire exceed the size of semaphore.");
+        }
+        if(TryAcquire(n)) {
+            return;
+        }
+        _SemaWaiter w(n);
+        lock lc(mu_);
+        _Enqueue(&w);
+        w.cv.wait(lc, [&]() { return w.granted; });
+    }
+
+    // Acquire `n` units, blocking until they are available, or give up when `ctx` is done.
+    // A request exceeding the size waits for `ctx` without blocking the waiters behind it.
+    // Return 1 if success, return -3 if ctx is done.
+    int Acquire(int64_t n, const SharedContext& ctx) {
+        if(ctx->IsDone()) {
+            return -3;
+        }
+        if(TryAcquire(n)) {
+            return 1;
+        }
+        if(n > size_) {
+            ctx->Done()->Pop(nullptr);
+            return -3;
+        }
+        _SemaWaiter w(n);
+        w.sem = this;
+        _Waiter cw;
+        cw.arg = &w;
+        cw.wake = &Semaphore::_Interrupt;
+        if(!ctx->_AddWaiter(&cw)) {
+            return -3;
+        }
+        int res = 1;
+        {
+            lock lc(mu_);
+            _Enqueue(&w);
+            w.cv.wait(lc, [&]() { return w.granted || ctx->IsDone(); });
+            if(!w.granted) {
+                waiters_.Remove(&w.node);
+                _Grant();   // the waiters behind it may fit now
+                res = -3;
+            }
+        }
+        ctx->_RemoveWaiter(&cw);
+        return res;
+    }
+
+    // Acquire `n` units if they are available now and nobody waits.
+    // Return false without acquiring any unit if not.
+    bool TryAcquire(int64_t n = 1) {
+        int64_t s = state_.load();
+        while((s & 1) == 0 && (s >> 1) >= n) {
+            if(state_.compare_exchange_weak(s, s - (n << 1))) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Release `n` units, and wake the waiters they are enough for, in FIFO order.
+    // Throw a logic_error if more units are released than have been acquired.
+    void Release(int64_t n = 1) {
+        int64_t s = state_.load();
+        while((s & 1) == 0) {
+            if((s >> 1) + n > size_) {
+                throw std::logic_error("semaphore released more than held.");
+            }
+            if(state_.compare_exchange_weak(s, s + (n << 1))) {
+                return;
+            }
+        }
+        lock lc(mu_);
+        s = state_.fetch_add(n << 1) + (n << 1);
+        if((s >> 1) > size_) {
+            state_.fetch_sub(n << 1);
+            throw std::logic_error("semaphore released more than held.");
+        }
+        _Grant();
+    }
+
+    // Return the number of units available now.
+    int64_t Available() {
+        return state_.load() >> 1;
+    }
+
+    int64_t Size() {
+        return size_;
+    }
+
+private:
+    // A blocked Acquire(), which lives on its stack.
+    // It is notified with `mu_` locked, so it cannot return and destroy it while being notified.
+    struct _SemaWaiter {
+        explicit _SemaWaiter(int64_t units) : n(units), granted(false), sem(nullptr) {
+            node.arg = this;
+        }
+
+        _Waiter node;
+        int64_t n;
+        bool granted;
+        std::condition_variable cv;
+
+        // The semaphore, for the context to interrupt it.
+        Semaphore* sem;
+    };
+
+    // Queue a waiter with `mu_` locked, and grant it at once if it is the first and fits.
+    // Once the waiters bit is set, the fast paths back off, and the units only change with `mu_` locked.
+    void _Enqueue(_SemaWaiter* w) {
+        state_.fetch_or(1);
+        waiters_.Add(&w->node);
+        _Grant();
+    }
+
+    // Grant the units to the waiters from the front, while they fit, with `mu_` locked.
+    // Clear the waiters bit when nobody waits any more.
+    void _Grant() {
+        while(_Waiter* front = waiters_.Front()) {
+            _SemaWaiter* w = static_cast<_SemaWaiter*>(front->arg);
+            if((state_.load() >> 1) < w->n) {
+                break;
+            }
+            state_.fetch_sub(w->n << 1);
+            waiters_.PopFront();
+            w->granted = true;
+            w->cv.notify_one();
+        }
+        if(waiters_.Empty()) {
+            state_.fetch_and(~static_cast<int64_t>(1));
+        }
+    }
+
+    // Wake up the Acquire() of `w->arg` so that it can check its context.
+    static void _Interrupt(_Waiter* w) {
+        _SemaWaiter* sw = static_cast<_SemaWaiter*>(w->arg);
+        lock lc(sw->sem->mu_);
+        sw->cv.notify_one();
+    }
+
+    int64_t size_;
+
+    // The available units in the high bits, and whether anybody waits in the lowest bit.
+    std::atomic<int64_t> state_;
+
+    std::mutex mu_;
+
+    _WaitList waiters_;
+};
+
+}
+
+#endif //RTDSYNC_SEMAPHORE_H
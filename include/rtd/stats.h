@@ -0,0 +1,274 @@
+#ifndef RTDSYNC_STATS_H
+#define RTDSYNC_STATS_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+// Instrumentation of the primitives, compiled in by defining RTDSYNC_STATS,
+// or by the CMake option of the same name.
+// Without it, the counters do not exist and the statements in RTDSYNC_STAT() are removed,
+// so nothing is paid for; SnapshotStats() still exists and returns nothing.
+#ifdef RTDSYNC_STATS
+#define RTDSYNC_STAT(...) __VA_ARGS__
+#else
+#define RTDSYNC_STAT(...)
+#endif
+
+namespace rtd {
+
+// The counters of one live object.
+struct StatsEntry {
+    // "chan", "ringbuf" or "timers".
+    std::string kind;
+
+    // The address of the object, unique among the live ones.
+    uintptr_t id;
+
+    std::vector<std::pair<std::string, uint64_t>> counters;
+};
+
+#ifdef RTDSYNC_STATS
+
+inline int64_t _StatsNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// A node of the registry of live objects.
+// The counters are atomics updated with relaxed order, so a snapshot does not lock any object.
+struct _StatsNode {
+    _StatsNode* prev;
+    _StatsNode* next;
+
+    // The object the counters belong to.
+    const void* owner;
+
+    const char* kind;
+
+    // Append the counters of the node to an entry.
+    void (*collect)(const _StatsNode* n, StatsEntry* e);
+};
+
+class _StatsRegistry {
+    typedef std::lock_guard<std::mutex> guard;
+
+public:
+    _StatsRegistry() {
+        head_.prev = &head_;
+        head_.next = &head_;
+    }
+
+    void Add(_StatsNode* n) {
+        guard lc(mu_);
+        n->prev = head_.prev;
+        n->next = &head_;
+        head_.prev->next = n;
+        head_.prev = n;
+    }
+
+    void Remove(_StatsNode* n) {
+        guard lc(mu_);
+        n->prev->next = n->next;
+        n->next->prev = n->prev;
+    }
+
+    std::vector<StatsEntry> Snapshot() {
+        std::vector<StatsEntry> res;
+        guard lc(mu_);
+        for(_StatsNode* n = head_.next; n != &head_; n = n->next) {
+            res.push_back(StatsEntry());
+            res.back().kind = n->kind;
+            res.back().id = reinterpret_cast<uintptr_t>(n->owner);
+            n->collect(n, &res.back());
+        }
+        return res;
+    }
+
+private:
+    std::mutex mu_;
+
+    _StatsNode head_;
+};
+
+// It is never destroyed, so that objects can still unregister in static destructors.
+inline _StatsRegistry& _Stats() {
+    static _StatsRegistry* r = new _StatsRegistry();
+    return *r;
+}
+
+// Add the time since `start` to a counter, if `start` is not zero.
+inline void _StatsSince(std::atomic<uint64_t>& ns, std::atomic<uint64_t>& times, int64_t start) {
+    if(start != 0) {
+        ns.fetch_add(_StatsNow() - start, std::memory_order_relaxed);
+        times.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+inline void _StatsInc(std::atomic<uint64_t>& c, uint64_t n = 1) {
+    c.fetch_add(n, std::memory_order_relaxed);
+}
+
+// The counters of a channel, updated with the channel locked.
+struct _ChanStats : _StatsNode {
+    std::atomic<uint64_t> cap;
+    std::atomic<uint64_t> pushes;
+    std::atomic<uint64_t> pops;
+    std::atomic<uint64_t> pushBlocks;
+    std::atomic<uint64_t> pushBlockedNs;
+    std::atomic<uint64_t> popBlocks;
+    std::atomic<uint64_t> popBlockedNs;
+    std::atomic<uint64_t> lockContended;
+    std::atomic<uint64_t> lockWaitNs;
+    std::atomic<uint64_t> len;
+    std::atomic<uint64_t> highWater;
+
+    explicit _ChanStats(const void* o) : cap(0), pushes(0), pops(0), pushBlocks(0), pushBlockedNs(0),
+            popBlocks(0), popBlockedNs(0), lockContended(0), lockWaitNs(0), len(0), highWater(0) {
+        owner = o;
+        kind = "chan";
+        collect = &_ChanStats::_Collect;
+        _Stats().Add(this);
+    }
+
+    ~_ChanStats() {
+        _Stats().Remove(this);
+    }
+
+    // Record a push, with the length of the queue after it.
+    void Pushed(size_t n) {
+        _StatsInc(pushes);
+        len.store(n, std::memory_order_relaxed);
+        if(n > highWater.load(std::memory_order_relaxed)) {
+            highWater.store(n, std::memory_order_relaxed);
+        }
+    }
+
+    // Record a pop, with the length of the queue after it.
+    void Popped(size_t n) {
+        _StatsInc(pops);
+        len.store(n, std::memory_order_relaxed);
+    }
+
+    static void _Collect(const _StatsNode* n, StatsEntry* e) {
+        const _ChanStats* s = static_cast<const _ChanStats*>(n);
+        e->counters = {
+            {"cap", s->cap.load(std::memory_order_relaxed)},
+            {"len", s->len.load(std::memory_order_relaxed)},
+            {"high_water", s->highWater.load(std::memory_order_relaxed)},
+            {"pushes", s->pushes.load(std::memory_order_relaxed)},
+            {"pops", s->pops.load(std::memory_order_relaxed)},
+            {"push_blocks", s->pushBlocks.load(std::memory_order_relaxed)},
+            {"push_blocked_ns", s->pushBlockedNs.load(std::memory_order_relaxed)},
+            {"pop_blocks", s->popBlocks.load(std::memory_order_relaxed)},
+            {"pop_blocked_ns", s->popBlockedNs.load(std::memory_order_relaxed)},
+            {"lock_contended", s->lockContended.load(std::memory_order_relaxed)},
+            {"lock_wait_ns", s->lockWaitNs.load(std::memory_order_relaxed)},
+        };
+    }
+};
+
+// The counters of a RingBuffer.
+struct _RingBufferStats : _StatsNode {
+    std::atomic<uint64_t> cap;
+    std::atomic<uint64_t> puts;
+    std::atomic<uint64_t> gets;
+
+    // Failed CASes on the cursors, lost to another putter or getter.
+    // Spinning on a full or empty buffer is not counted.
+    std::atomic<uint64_t> putRetries;
+    std::atomic<uint64_t> getRetries;
+
+    explicit _RingBufferStats(const void* o) : cap(0), puts(0), gets(0), putRetries(0), getRetries(0) {
+        owner = o;
+        kind = "ringbuf";
+        collect = &_RingBufferStats::_Collect;
+        _Stats().Add(this);
+    }
+
+    ~_RingBufferStats() {
+        _Stats().Remove(this);
+    }
+
+    static void _Collect(const _StatsNode* n, StatsEntry* e) {
+        const _RingBufferStats* s = static_cast<const _RingBufferStats*>(n);
+        e->counters = {
+            {"cap", s->cap.load(std::memory_order_relaxed)},
+            {"puts", s->puts.load(std::memory_order_relaxed)},
+            {"gets", s->gets.load(std::memory_order_relaxed)},
+            {"put_retries", s->putRetries.load(std::memory_order_relaxed)},
+            {"get_retries", s->getRetries.load(std::memory_order_relaxed)},
+        };
+    }
+};
+
+// The counters of the timers poller, with a histogram of how late timers run after their `when`.
+// Bucket i counts the timers late by less than 2^i microseconds, the last one counts the rest.
+struct _TimerStats : _StatsNode {
+    static const int buckets = 22;
+
+    std::atomic<uint64_t> fired;
+    std::atomic<uint64_t> lateNs;
+    std::atomic<uint64_t> late[buckets];
+
+    _TimerStats() : fired(0), lateNs(0) {
+        for(int i = 0; i < buckets; i++) {
+            late[i] = 0;
+        }
+        owner = this;
+        kind = "timers";
+        collect = &_TimerStats::_Collect;
+        _Stats().Add(this);
+    }
+
+    void Fire(int64_t lateness) {
+        if(lateness < 0) {
+            lateness = 0;
+        }
+        _StatsInc(fired);
+        _StatsInc(lateNs, lateness);
+        int i = 0;
+        for(int64_t us = lateness / 1000; us > 0 && i < buckets - 1; us >>= 1) {
+            i++;
+        }
+        _StatsInc(late[i]);
+    }
+
+    static void _Collect(const _StatsNode* n, StatsEntry* e) {
+        const _TimerStats* s = static_cast<const _TimerStats*>(n);
+        e->counters.push_back({"fired", s->fired.load(std::memory_order_relaxed)});
+        e->counters.push_back({"late_ns", s->lateNs.load(std::memory_order_relaxed)});
+        for(int i = 0; i < buckets - 1; i++) {
+            e->counters.push_back({"late_lt_" + std::to_string(1 << i) + "us", s->late[i].load(std::memory_order_relaxed)});
+        }
+        e->counters.push_back({"late_ge_" + std::to_string(1 << (buckets - 2)) + "us",
+                               s->late[buckets - 1].load(std::memory_order_relaxed)});
+    }
+};
+
+// The timers poller is a singleton, and so are its counters.
+inline _TimerStats& _TimerStatsOf() {
+    static _TimerStats* s = new _TimerStats();
+    return *s;
+}
+
+// Return the counters of all live instrumented objects.
+inline std::vector<StatsEntry> SnapshotStats() {
+    return _Stats().Snapshot();
+}
+
+#else
+
+// Return the counters of all live instrumented objects, none without RTDSYNC_STATS.
+inline std::vector<StatsEntry> SnapshotStats() {
+    return std::vector<StatsEntry>();
+}
+
+#endif
+
+}
+
+#endif //RTDSYNC_STATS_H
@@ -20,12 +20,24 @@ A stopped timer lifecycle:
 #define RTDCHAN_TICKER_H
 
 #include "chan.h"
+#include "pool.h"
 #include <thread>
 #include <chrono>
 #include <iostream>
-#include <queue>
+#include <vector>
+#include <algorithm>
 #include <mutex>
 #include <atomic>
+#include <ctime>
+#include <system_error>
+
+#if defined(__linux__)
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 namespace rtd {
 
@@ -33,13 +45,100 @@ namespace time {
 
 using namespace std::chrono;
 using SysTimePoint = system_clock::time_point;
+using MonoTimePoint = steady_clock::time_point;
 
-SysTimePoint Now() {
+// Return the wall clock time.
+// It is only used for display and the value pushed into timer channels,
+// all deadlines are measured by the monotonic clock, see `MonoNow()`.
+inline SysTimePoint Now() {
     return system_clock::now();
 }
 
+// The clock of timers.
+// All deadlines are read from the clock installed by `SetClock()`, `SteadyClock` by default.
+class Clock {
+public:
+    virtual MonoTimePoint Now() = 0;
+
+    // The granularity of the clock.
+    // The poller sleeps this much longer than a deadline so that a reading has passed it when waking.
+    virtual nanoseconds Resolution() {
+        return nanoseconds(0);
+    }
+
+    // A virtual clock does not advance by itself.
+    // The poll thread stays idle, and timers are run by whoever advances the clock.
+    virtual bool IsVirtual() {
+        return false;
+    }
+
+    virtual ~Clock() {}
+};
+
+// The clock reading std::chrono::steady_clock.
+class SteadyClock : public Clock {
+public:
+    MonoTimePoint Now() override {
+        return steady_clock::now();
+    }
+};
+
+// The clock reading CLOCK_MONOTONIC_COARSE where it is available,
+// which is much cheaper but only advances once per scheduler tick (typically 1-4ms).
+// It falls back to steady_clock on other platforms.
+class CoarseClock : public Clock {
+public:
+    CoarseClock() : res_(0) {
+#if defined(CLOCK_MONOTONIC_COARSE)
+        struct timespec ts;
+        clock_getres(CLOCK_MONOTONIC_COARSE, &ts);
+        res_ = seconds(ts.tv_sec) + nanoseconds(ts.tv_nsec);
+#endif
+    }
+
+    MonoTimePoint Now() override {
+#if defined(CLOCK_MONOTONIC_COARSE)
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return MonoTimePoint(duration_cast<steady_clock::duration>(seconds(ts.tv_sec) + nanoseconds(ts.tv_nsec)));
+#else
+        return steady_clock::now();
+#endif
+    }
+
+    nanoseconds Resolution() override {
+        return res_;
+    }
+
+private:
+    nanoseconds res_;
+};
+
+// The built-in clock sources, see `SetClockSource()`.
+enum class ClockSource {
+    steady,
+    coarse
+};
+
+inline Clock* _BuiltinClock(ClockSource source) {
+    static SteadyClock* steady = new SteadyClock();
+    static CoarseClock* coarse = new CoarseClock();
+    return source == ClockSource::coarse ? static_cast<Clock*>(coarse) : steady;
+}
+
+inline std::atomic<Clock*>& _Clock() {
+    static std::atomic<Clock*> clock(_BuiltinClock(ClockSource::steady));
+    return clock;
+}
+
+// Return the monotonic time from the installed clock.
+// It never jumps when the wall clock is changed.
+inline MonoTimePoint MonoNow() {
+    return _Clock().load()->Now();
+}
+
 // Transit a time_point to ctime string
-std::string Ctime(SysTimePoint timePoint) {
+inline std::string Ctime(SysTimePoint timePoint) {
     time_t t = system_clock::to_time_t(timePoint);
     std::string cs = std::string(std::ctime(&t));
     cs.erase(cs.size() - 1);
@@ -55,56 +154,125 @@ enum class _TimerStatus {
     noStatus
 };
 
+// How a ticker deals with the periods that passed while it was late.
+enum class TickPolicy {
+    // Skip the missed periods, and fire once for the latest one. It is the default.
+    skip,
+
+    // Fire once for every missed period, back to back, until it catches up.
+    // The channel of a burst ticker keeps up to `burstBuffer` ticks by default, so that they are not dropped.
+    burst,
+
+    // Fire once, and deliver the number of periods elapsed since the last delivered tick.
+    // Periods are kept pending while the channel is full, so none of them is lost.
+    coalesce
+};
+
+// The default channel capacity of a ticker in `TickPolicy::burst`,
+// the number of missed periods it catches up with while its consumer is away.
+constexpr int burstBuffer = 64;
+
+// A tick delivered by a ticker in `TickPolicy::coalesce`.
+struct Tick {
+    SysTimePoint time;
+
+    // The number of periods elapsed since the previous delivered tick, at least 1.
+    int64_t periods;
+};
+
 // Internal Timer struct
 struct _Timer {
     // when is the end of timer
-    SysTimePoint when;
+    MonoTimePoint when;
 
     // The duration of ticker
     nanoseconds period;
 
+    // How late the timer is allowed to fire after `when`.
+    // The poller sleeps until the earliest `when + slack`,
+    // and runs every timer whose `when` has passed in the same wakeup.
+    nanoseconds slack;
+
     // The status of timer
     std::atomic<_TimerStatus> status;
 
+    // How a ticker deals with missed periods.
+    TickPolicy policy;
+
+    // The number of periods a ticker failed to deliver.
+    std::atomic<int64_t> missed;
+
+    // The periods a coalescing ticker has not delivered yet, only touched by Do().
+    int64_t pending;
+
     // What to do reach the `when`.
+    // It is called with the number of periods elapsed since the previous run, which is 1 for a timer.
     // Must be an non-blocking function.
-    std::function<void()> Do;
+    void (*Do)(_Timer* t, int64_t periods);
 
-    // What to do reach the end of timer.
+    // What to do reach the end of a disposable timer, or nullptr.
     // Must be an non-blocking function.
-    std::function<void()> End;
+    void (*End)(_Timer* t);
+
+    // The argument of Do() and End().
+    // Plain functions with a shared argument do not allocate, unlike std::function with captures.
+    std::shared_ptr<void> arg;
 };
 
 using _SharedTimer = std::shared_ptr<_Timer>;
 
+// Create a timer in the block pools.
+inline _SharedTimer _NewTimer() {
+    _SharedTimer t = std::allocate_shared<_Timer>(PoolAllocator<_Timer>());
+    t->period = nanoseconds(0);
+    t->slack = nanoseconds(0);
+    t->status = _TimerStatus::noStatus;
+    t->policy = TickPolicy::skip;
+    t->missed = 0;
+    t->pending = 0;
+    t->Do = nullptr;
+    t->End = nullptr;
+    return t;
+}
+
 struct _SharedTimerComparsion {
     bool operator()(const _SharedTimer& t1, const _SharedTimer& t2) {
         return t1->when > t2->when;
     }
 };
 
+// An external driver of the timer heap, such as `TimerFd`.
+// When a driver is attached, the timers poll thread stays idle,
+// and the driver is told whenever a timer may become the earliest one of the heap.
+struct _TimerDriver {
+    // Make sure the driver wakes up no later than `until`.
+    // It is called with the heap locked.
+    virtual void Rearm(MonoTimePoint until) = 0;
+
+    virtual ~_TimerDriver() {}
+};
+
 // Timer Heap.
-// We put all timers into a minimum heap.
+// We put all timers into a minimum heap of `when`.
 struct _TimersHeap {
-    std::priority_queue<_SharedTimer, std::vector<_SharedTimer>, _SharedTimerComparsion> timers;
+    std::vector<_SharedTimer> timers;
     std::mutex mu;
     std::condition_variable cv;
+    std::atomic<_TimerDriver*> driver;
+
+    // The heap must be locked when calling the functions below, except Lock().
 
     void Pop() {
-        if(mu.try_lock()) {
-            timers.pop();
-            mu.unlock();
-        } else {
-            timers.pop();
-        }
+        std::pop_heap(timers.begin(), timers.end(), _SharedTimerComparsion());
+        timers.pop_back();
     }
 
     void Push(const _SharedTimer& t) {
-        if(mu.try_lock()) {
-            timers.push(t);
-            mu.unlock();
-        } else {
-            timers.push(t);
+        timers.push_back(t);
+        std::push_heap(timers.begin(), timers.end(), _SharedTimerComparsion());
+        _TimerDriver* d = driver;
+        if(d != nullptr) {
+            d->Rearm(t->when + t->slack);
         }
         cv.notify_one();
     }
@@ -114,19 +282,35 @@ struct _TimersHeap {
     }
 
     const _SharedTimer& Top() {
-        return timers.top();
-    }
-
-    void Wait() {
-        std::mutex wmu;
-        std::unique_lock<std::mutex> lc(wmu);
-        cv.wait(lc);
+        return timers.front();
     }
 
-    void WaitUntil(SysTimePoint& until) {
-        std::mutex wmu;
-        std::unique_lock<std::mutex> lc(wmu);
-        cv.wait_until(lc, until);
+    // Return the earliest `when + slack` of the waiting timers, or MonoTimePoint::max() if none.
+    // A timer with a large slack may be on top of one with a small slack, so it is not always the top one.
+    // The children of a timer are not earlier than it, so the search skips the subtree of any timer
+    // whose `when` is not earlier than the deadline found so far; without slack, only the top is visited.
+    MonoTimePoint NextDeadline() {
+        MonoTimePoint next = MonoTimePoint::max();
+        std::vector<size_t>& stack = scan_;
+        stack.clear();
+        if(!timers.empty()) {
+            stack.push_back(0);
+        }
+        while(!stack.empty()) {
+            size_t i = stack.back();
+            stack.pop_back();
+            const _Timer* t = timers[i].get();
+            if(t->when >= next) {
+                continue;
+            }
+            if(t->status == _TimerStatus::waiting && t->when + t->slack < next) {
+                next = t->when + t->slack;
+            }
+            for(size_t c = 2 * i + 1; c <= 2 * i + 2 && c < timers.size(); c++) {
+                stack.push_back(c);
+            }
+        }
+        return next;
     }
 
     void Lock() {
@@ -137,67 +321,82 @@ struct _TimersHeap {
         mu.unlock();
     }
 
-} _heap;
+private:
+    // The indexes to visit in NextDeadline(), kept to avoid allocating on every wakeup.
+    std::vector<size_t> scan_;
+};
+
+// The timer heap of the process.
+// It is never destroyed, so that timers can still be stopped in static destructors.
+inline _TimersHeap& _Heap() {
+    static _TimersHeap* heap = new _TimersHeap();
+    return *heap;
+}
 
 
-void _BadTimer() {
+inline void _BadTimer() {
     throw std::logic_error("racy use of timers");
 }
 
 // Run a timer.
 // Pop a timer and call Do(). Calculate the next `when` if the timer is a ticker, and push into heap again.
 // Pop it, call Do() and End() if it is a disposable timer.
-void _RunOneTimer(_SharedTimer t, SysTimePoint& now) {
+inline void _RunOneTimer(_SharedTimer t, MonoTimePoint& now) {
+    RTDSYNC_STAT(_TimerStatsOf().Fire(duration_cast<nanoseconds>(now - t->when).count()));
+    RTDSYNC_TRACE_DO(_Trace(TraceEvent::timer, t.get(), duration_cast<nanoseconds>(now - t->when).count()));
     if(t->period > nanoseconds(0)) {
-        auto delta = t->when - now;
-        t->when += (1 + -delta/t->period) * t->period;
-        _heap.Pop();
-        _heap.Push(t);
+        int64_t periods = 1 + (now - t->when) / t->period;
+        if(t->policy == TickPolicy::burst) {   // the rest of the periods are run by the next passes
+            periods = 1;
+        }
+        t->when += periods * t->period;
+        _Heap().Pop();
+        _Heap().Push(t);
         t->status = _TimerStatus::waiting;
 
-        _heap.UnLock();
-        t->Do();
-        _heap.Lock();
+        _Heap().UnLock();
+        t->Do(t.get(), periods);
+        _Heap().Lock();
 
     } else {    // disposable timer when period == 0
-        _heap.Pop();
+        _Heap().Pop();
 
-        _heap.UnLock();
-        t->Do();
-        t->End();
-        _heap.Lock();
+        _Heap().UnLock();
+        t->Do(t.get(), 1);
+        if(t->End != nullptr) {
+            t->End(t.get());
+        }
+        _Heap().Lock();
 
         t->status = _TimerStatus::removed;
     }
 }
 
-// Check the top timer of the heap.
+// Check the top timers of the heap.
+// The clock is read once, and every timer whose `when` has passed is run in the same pass.
 // Return -1 if heap empty.
-// Return 1 if run a timer successfully.
-// Return 0 if do not reach the `when`.
-int _RunTimer(SysTimePoint* until) {
+// Return 0 if do not reach the `when`, and `until` is set to the next wakeup.
+inline int _RunTimer(MonoTimePoint* until) {
+    auto now = MonoNow();
     while(1) {
-        if(_heap.Empty()) {
+        if(_Heap().Empty()) {
             return -1;
         }
-        _SharedTimer t = _heap.Top();
-        auto now = Now();
+        _SharedTimer t = _Heap().Top();
+        _TimerStatus waiting = _TimerStatus::waiting;
         if(t->status == _TimerStatus::waiting){
             if(t->when > now) {
-                *until = t->when;
+                *until = _Heap().NextDeadline() + _Clock().load()->Resolution();
                 return 0;
             }
-            t->status = _TimerStatus::running;
-            _RunOneTimer(t, now);
-            return 1;
+            // _StopTimer() may delete it meanwhile, without the heap lock
+            if(t->status.compare_exchange_strong(waiting, _TimerStatus::running)) {
+                _RunOneTimer(t, now);
+            }
 
         } else if(t->status == _TimerStatus::deleted) {
-            _heap.Pop();
+            _Heap().Pop();
             t->status = _TimerStatus::removed;
-            if(_heap.Empty()) {
-                return -1;
-            }
-            break;
 
         } else if(t->status == _TimerStatus::noStatus
                     || t->status == _TimerStatus::removed) {    // An inactive timer should be popped
@@ -210,93 +409,405 @@ int _RunTimer(SysTimePoint* until) {
             _BadTimer();
         }
     }
-    return 0;
 }
 
-// Timers poll.
-// Blocking until the next `when`, unless a new timer push into heap.
-// Blocking if heap empty until a new timer push into heap.
-void _TimersPoll() {
-    SysTimePoint until;
-    while(1) {
-        _heap.Lock();
-        int res = _RunTimer(&until);
-        _heap.UnLock();
-        if(res == 0) {
-            _heap.WaitUntil(until);
-        } else if (res == -1) {         // No timer now
-            _heap.Wait();   // Waiting a new timer notice
+// The runtime of timers, which owns the timers poll thread.
+// The poll thread is started lazily by the first timer, or explicitly by Start(),
+// and it is stopped by Shutdown(). A runtime that has been shut down is started again by the next timer.
+// After fork(), the poll thread does not exist in the child,
+// call Start() in the child if its pending timers should keep firing before a new timer starts.
+class Runtime {
+public:
+    struct Options {
+        // The CPU to pin the poll thread on, -1 means no affinity.
+        int cpu;
+
+        // The SCHED_FIFO priority of the poll thread, 0 means the default scheduling policy.
+        int priority;
+
+        Options() : cpu(-1), priority(0) {}
+    };
+
+    // Return the runtime of the process.
+    // It is never destroyed, the poll thread may outlive static destructors.
+    static Runtime& Get() {
+        static Runtime* rt = new Runtime();
+        return *rt;
+    }
+
+    Runtime(const Runtime&) = delete;
+    Runtime& operator=(const Runtime&) = delete;
+
+    // Set the options of the poll thread.
+    // They are applied immediately if the poll thread is running, otherwise when it starts.
+    // Throw std::system_error if they cannot be applied, e.g. no permission for a realtime priority.
+    void Configure(const Options& opts) {
+        std::lock_guard<std::mutex> lc(mu_);
+        opts_ = opts;
+        if(thread_ != nullptr) {
+            _ApplyOptions();
+        }
+    }
+
+    // Start the poll thread if it is not running.
+    void Start() {
+        std::lock_guard<std::mutex> lc(mu_);
+        if(thread_ != nullptr) {
+            return;
+        }
+        thread_ = new std::thread(&Runtime::_Poll, this);
+        running_ = true;
+        _ApplyOptions();
+    }
+
+    // Stop the poll thread and wait for it to exit.
+    // Timers stay in the heap, and fire after the runtime is started again.
+    // It cannot be called inside a timer.
+    void Shutdown() {
+        std::lock_guard<std::mutex> lc(mu_);
+        if(thread_ == nullptr) {
+            return;
         }
+        if(thread_->get_id() == std::this_thread::get_id()) {
+            throw std::logic_error("cannot shut down the timer runtime inside a timer.");
+        }
+        _TimersHeap& heap = _Heap();
+        heap.Lock();
+        stop_ = true;
+        heap.UnLock();
+        heap.cv.notify_all();
+
+        thread_->join();
+        delete thread_;
+        thread_ = nullptr;
+        running_ = false;
+        stop_ = false;
+    }
+
+    bool IsRunning() {
+        return running_;
+    }
+
+    // Start the poll thread for a new timer,
+    // unless it is running or an external driver is attached.
+    void _Ensure() {
+        if(running_ || _Heap().driver != nullptr || _Clock().load()->IsVirtual()) {
+            return;
+        }
+        Start();
+    }
+
+private:
+    Runtime() : thread_(nullptr), running_(false), stop_(false) {
+#if defined(__linux__)
+        pthread_atfork(&Runtime::_ForkPrepare, &Runtime::_ForkParent, &Runtime::_ForkChild);
+#endif
+    }
+
+    void _ApplyOptions() {
+#if defined(__linux__)
+        pthread_t h = thread_->native_handle();
+        if(opts_.cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(opts_.cpu, &set);
+            int err = pthread_setaffinity_np(h, sizeof(set), &set);
+            if(err != 0) {
+                throw std::system_error(err, std::system_category(), "pthread_setaffinity_np");
+            }
+        }
+        if(opts_.priority > 0) {
+            struct sched_param param = {};
+            param.sched_priority = opts_.priority;
+            int err = pthread_setschedparam(h, SCHED_FIFO, &param);
+            if(err != 0) {
+                throw std::system_error(err, std::system_category(), "pthread_setschedparam");
+            }
+        }
+#endif
+    }
+
+    // Timers poll.
+    // Blocking until the next `when`, unless a new timer push into heap.
+    // Blocking if heap empty until a new timer push into heap.
+    // Staying idle while an external driver or a virtual clock is installed.
+    void _Poll() {
+        _TimersHeap& heap = _Heap();
+        MonoTimePoint until;
+        std::unique_lock<std::mutex> lc(heap.mu);
+        while(!stop_) {
+            if(heap.driver != nullptr || _Clock().load()->IsVirtual()) {
+                heap.cv.wait(lc);
+                continue;
+            }
+            int res = _RunTimer(&until);
+            if(stop_) {
+                break;
+            }
+            if(res == 0) {
+                heap.cv.wait_until(lc, until);
+            } else if(res == -1) {      // No timer now
+                heap.cv.wait(lc);       // Waiting a new timer notice
+            }
+        }
+    }
+
+    // Hold the locks across fork(), so that the child does not inherit them in a locked state.
+    static void _ForkPrepare() {
+        Get().mu_.lock();
+        _Heap().Lock();
+    }
+
+    static void _ForkParent() {
+        _Heap().UnLock();
+        Get().mu_.unlock();
+    }
+
+    // Only the forking thread exists in the child, forget the poll thread without joining it.
+    static void _ForkChild() {
+        Runtime& rt = Get();
+        rt.thread_ = nullptr;
+        rt.running_ = false;
+        rt.stop_ = false;
+        _Heap().UnLock();
+        rt.mu_.unlock();
+    }
+
+    std::mutex mu_;
+
+    Options opts_;
+
+    std::thread* thread_;
+
+    std::atomic<bool> running_;
+
+    // Guarded by the heap lock.
+    bool stop_;
+};
+
+// Install the clock of timers.
+// The clock must outlive every timer, and it should be installed before starting any timer,
+// since the deadlines of started timers are read from the previous clock.
+// A running poll thread is woken to read the new clock. It is not started here, the first timer starts it,
+// unless timers are left pending by a virtual clock, which would never fire otherwise.
+inline void SetClock(Clock* clock) {
+    _TimersHeap& heap = _Heap();
+    heap.Lock();
+    _Clock() = clock;
+    bool pending = !heap.Empty();
+    heap.UnLock();
+    heap.cv.notify_all();
+    if(pending) {
+        Runtime::Get()._Ensure();
     }
 }
 
-// Run the timers poll in a thread.
-void _RunTimersPoll() {
-    std::thread([]() {
-        _TimersPoll();
-    }).detach();
+// Install a built-in clock.
+inline void SetClockSource(ClockSource source) {
+    SetClock(_BuiltinClock(source));
 }
 
-// Running the timers poll since the beginning of program
-struct _TimersPollRunner {
-    _TimersPollRunner() {
-        _RunTimersPoll();
+// A virtual clock for deterministic tests and benchmarks.
+// It only moves when `Advance()` is called, which runs the expired timers in the calling thread,
+// by the same logic the poll thread uses.
+class ManualClock : public Clock {
+public:
+    ManualClock() : ns_(steady_clock::now().time_since_epoch().count()) {}
+
+    explicit ManualClock(MonoTimePoint start) : ns_(start.time_since_epoch().count()) {}
+
+    MonoTimePoint Now() override {
+        return MonoTimePoint(steady_clock::duration(ns_.load()));
     }
-} _run;
 
-// Clean timer heap.
-// Pop the timer from heap that have been deleted.
-bool _CleanTimer() {
-    if(_heap.Empty()) {
+    bool IsVirtual() override {
         return true;
     }
-    while(1){
-        _SharedTimer t = _heap.Top();
+
+    // Move the clock forward by `d`.
+    // It stops at every deadline on the way, so a ticker fires once per period
+    // just as it does with a real clock.
+    template <typename T, typename U>
+    void Advance(duration<T, U> d) {
+        std::lock_guard<std::mutex> alc(mu_);
+        MonoTimePoint target = Now() + duration_cast<steady_clock::duration>(d);
+        MonoTimePoint until;
+        _TimersHeap& heap = _Heap();
+        heap.Lock();
+        while(_RunTimer(&until) == 0 && until <= target) {
+            _Set(until);
+        }
+        _Set(target);
+        _RunTimer(&until);
+        heap.UnLock();
+    }
+
+private:
+    void _Set(MonoTimePoint tp) {
+        if(tp > Now()) {
+            ns_ = tp.time_since_epoch().count();
+        }
+    }
+
+    // Serialize the callers of Advance().
+    std::mutex mu_;
+
+    std::atomic<steady_clock::rep> ns_;
+};
+
+#if defined(__linux__)
+
+// A timer driver backed by a timerfd, for integrating timers into an existing event loop.
+// Register `Fd()` for EPOLLIN in your own epoll loop, and call `ProcessExpired()` when it becomes readable.
+// The timerfd is always armed for the earliest deadline of the heap.
+// While a TimerFd exists, the timers poll thread stays idle and timers only run inside `ProcessExpired()`,
+// so their `Do()` runs in the thread of your event loop.
+// Only one TimerFd can exist at a time.
+class TimerFd : public _TimerDriver {
+public:
+    TimerFd() : armed_(MonoTimePoint::max()) {
+        fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if(fd_ < 0) {
+            throw std::system_error(errno, std::system_category(), "timerfd_create");
+        }
+        _TimerDriver* expected = nullptr;
+        if(!_Heap().driver.compare_exchange_strong(expected, this)) {
+            close(fd_);
+            throw std::logic_error("another timer driver has been attached.");
+        }
+        _Heap().Lock();
+        Rearm(_Heap().NextDeadline());
+        _Heap().UnLock();
+    }
+
+    TimerFd(const TimerFd&) = delete;
+    TimerFd& operator=(const TimerFd&) = delete;
+
+    // Detach from the heap, and hand the timers back to the poll thread.
+    ~TimerFd() {
+        _Heap().Lock();
+        _Heap().driver = nullptr;
+        _Heap().UnLock();
+        _Heap().cv.notify_one();
+        close(fd_);
+        Runtime::Get()._Ensure();
+    }
+
+    // The file descriptor to register in an event loop.
+    int Fd() const {
+        return fd_;
+    }
+
+    // Run every expired timer, and rearm the timerfd for the earliest `when + slack` left in the heap.
+    // It is non-blocking, and it is fine to call it even if the fd is not readable.
+    void ProcessExpired() {
+        uint64_t expirations;
+        while(read(fd_, &expirations, sizeof(expirations)) > 0) {}
+
+        MonoTimePoint until;
+        _Heap().Lock();
+        armed_ = MonoTimePoint::max();
+        int res = _RunTimer(&until);
+        if(res == 0) {
+            Rearm(until);
+        } else {
+            _SetTime(MonoTimePoint::max());
+        }
+        _Heap().UnLock();
+    }
+
+private:
+    void Rearm(MonoTimePoint until) override {
+        if(until < armed_) {
+            _SetTime(until);
+        }
+    }
+
+    void _SetTime(MonoTimePoint until) {
+        struct itimerspec its = {};
+        if(until != MonoTimePoint::max()) {     // zero it_value disarms the timerfd
+            auto ns = duration_cast<nanoseconds>(until.time_since_epoch()).count();
+            if(ns <= 0) {
+                ns = 1;
+            }
+            its.it_value.tv_sec = ns / 1000000000;
+            its.it_value.tv_nsec = ns % 1000000000;
+        }
+        if(timerfd_settime(fd_, TFD_TIMER_ABSTIME, &its, nullptr) < 0) {
+            throw std::system_error(errno, std::system_category(), "timerfd_settime");
+        }
+        armed_ = until;
+    }
+
+    int fd_;
+
+    // The deadline the timerfd is armed for, guarded by the heap lock.
+    MonoTimePoint armed_;
+};
+
+#endif
+
+// Clean timer heap.
+// Pop the timer from heap that have been deleted.
+inline bool _CleanTimer() {
+    while(!_Heap().Empty()) {
+        _SharedTimer t = _Heap().Top();
         if(t->status == _TimerStatus::deleted) {
-            _heap.Pop();
+            _Heap().Pop();
             t->status = _TimerStatus::removed;
         } else {
             return true;
         }
     }
+    return true;
 }
 
 // Add a timer.
 // Clean timer heap before adding.
-void _AddTimer(const _SharedTimer& t) {
-    if(t->status != _TimerStatus::noStatus) {
+// A timer stopped by another thread before it is added is not added, see _StopTimer().
+inline void _AddTimer(const _SharedTimer& t) {
+    _TimerStatus s = _TimerStatus::noStatus;
+    if(!t->status.compare_exchange_strong(s, _TimerStatus::waiting)) {
+        if(s == _TimerStatus::removed) {
+            return;
+        }
         _BadTimer();
     }
-    t->status = _TimerStatus::waiting;
-    _heap.Lock();
+    Runtime::Get()._Ensure();
+    _Heap().Lock();
     if(!_CleanTimer()) {
         _BadTimer();
     }
-    _heap.Push(t);
-    _heap.UnLock();
+    _Heap().Push(t);
+    _Heap().UnLock();
 }
 
 // Stop a timer.
 // Delete a timer by signing the status as deleted.
 // _CleanTimer() and timers poll will pop the deleted timers.
 // The function will blocking if the timer to delete is running.
+// The status is changed by CAS, since the poller may start running the timer at the same time,
+// so once it returns, a disposable timer is not running and never runs again.
 // Return false if the timer is stopped or stopping.
-bool _StopTimer(const _SharedTimer& t) {
+inline bool _StopTimer(const _SharedTimer& t) {
     while(1) {
-        if(t->status == _TimerStatus::waiting) {
-            t->status = _TimerStatus::deleted;
-            return true;
+        _TimerStatus s = t->status;
+        if(s == _TimerStatus::waiting) {
+            if(t->status.compare_exchange_strong(s, _TimerStatus::deleted)) {
+                return true;
+            }
 
-        } else if(t->status == _TimerStatus::deleted
-                  || t->status == _TimerStatus::removed) {
+        } else if(s == _TimerStatus::deleted
+                  || s == _TimerStatus::removed) {
             return false;
 
-        } else if(t->status == _TimerStatus::running) {
+        } else if(s == _TimerStatus::running) {
             continue; // try again later
 
-        } else if(t->status == _TimerStatus::noStatus) { // do not start or end of run
-            t->status = _TimerStatus::removed;
-            return true;
+        } else if(s == _TimerStatus::noStatus) { // do not start or end of run
+            if(t->status.compare_exchange_strong(s, _TimerStatus::removed)) {
+                return true;
+            }
 
         } else {
             _BadTimer();
@@ -306,16 +817,26 @@ bool _StopTimer(const _SharedTimer& t) {
 }
 
 template <typename T, typename U>
-SysTimePoint When(duration<T, U> d) {
-    return Now() + d;
+inline MonoTimePoint When(duration<T, U> d) {
+    return MonoNow() + d;
 }
 
 // The user interface of timer.
 template <typename T, typename U>
 class Timer {
 public:
-    explicit Timer(duration<T, U> period) : period_(period), t_(std::make_shared<_Timer>()) {
-        t_->status = _TimerStatus::noStatus;
+    explicit Timer(duration<T, U> period) : period_(period), t_(_NewTimer()) {}
+
+    // Allow the timer to fire up to `slack` later than its deadline,
+    // so that the poller can serve nearby timers in one wakeup.
+    // It must be set before Start().
+    template <typename V, typename W>
+    Timer& SetSlack(duration<V, W> slack) {
+        if(t_->status != _TimerStatus::noStatus) {
+            throw std::logic_error("cannot set slack of timer that has been started or stopped.");
+        }
+        t_->slack = duration_cast<nanoseconds>(slack);
+        return *this;
     }
 
     // Start the timer.
@@ -333,7 +854,7 @@ public:
     bool Stop() {
         bool ok = _StopTimer(t_);
         if(ok) {
-            c_->Close();
+            _Close();
         }
         return ok;
     }
@@ -344,6 +865,15 @@ public:
         return c_;
     }
 
+    // The case of Select() that succeeds when the timer fires, with the time into `t`.
+    // The timer must have been started.
+    SelectCase Case(SysTimePoint* t) {
+        if(c_ == nullptr) {
+            throw std::logic_error("cannot select on timer that has not been started.");
+        }
+        return c_->PopCase(t);
+    }
+
     bool isStop() {
         return t_->status == _TimerStatus::removed
             || t_->status == _TimerStatus::deleted;
@@ -355,12 +885,24 @@ protected:
         t_->period = nanoseconds(0);
         t_->when = When(period_);
         t_->status = _TimerStatus::noStatus;
-        t_->Do = [&]() {
-            c_->TryPush(Now());     // non-blocking push
-        };
-        t_->End = [&]() {   // close the channel in the end of timer
+        t_->arg = c_;
+        t_->Do = &Timer::_Fire;
+        t_->End = &Timer::_End;
+    }
+
+    // Close the channels, which have not been created if the timer is not started.
+    virtual void _Close() {
+        if(c_ != nullptr) {
             c_->Close();
-        };
+        }
+    }
+
+    static void _Fire(_Timer* t, int64_t) {
+        static_cast<chan<SysTimePoint>*>(t->arg.get())->TryPush(Now());     // non-blocking push
+    }
+
+    static void _End(_Timer* t) {   // close the channel in the end of timer
+        static_cast<chan<SysTimePoint>*>(t->arg.get())->Close();
     }
 
 protected:
@@ -372,12 +914,50 @@ protected:
 };
 
 // A ticker.
+// Missed periods are handled according to its `TickPolicy`, see `SetPolicy()`.
 template <typename T, typename U>
 class Ticker : public Timer<T, U> {
 
 public:
-    explicit Ticker(const duration<T, U>& period) : Timer<T, U>(period) {
+    // `buffer` is the capacity of the channel, a larger one lets a consumer catch up with a burst.
+    // 0 picks the default by the policy at Start(): `burstBuffer` for `TickPolicy::burst`, 1 otherwise.
+    explicit Ticker(const duration<T, U>& period, int buffer = 0) : Timer<T, U>(period), buffer_(buffer) {
+
+    }
 
+    Ticker& Start() {
+        Timer<T, U>::Start();
+        return *this;
+    }
+
+    template <typename V, typename W>
+    Ticker& SetSlack(duration<V, W> slack) {
+        Timer<T, U>::SetSlack(slack);
+        return *this;
+    }
+
+    // Set the policy of missed periods.
+    // It must be set before Start().
+    // A ticker in `TickPolicy::coalesce` delivers into `Ticks()` instead of `Channel()`.
+    Ticker& SetPolicy(TickPolicy policy) {
+        if(t_->status != _TimerStatus::noStatus) {
+            throw std::logic_error("cannot set policy of ticker that has been started or stopped.");
+        }
+        t_->policy = policy;
+        return *this;
+    }
+
+    // Return the channel of a ticker in `TickPolicy::coalesce`.
+    // Each tick carries the number of periods elapsed since the previous delivered tick.
+    SharedChan<Tick> Ticks() {
+        return tc_;
+    }
+
+    // Return the number of periods that have not been delivered,
+    // skipped for being late or dropped for a full channel.
+    // A coalescing ticker never misses a period.
+    int64_t Missed() {
+        return t_->missed;
     }
 
 protected:
@@ -386,17 +966,49 @@ protected:
     using Timer<T, U>::period_;
 
     void _Set() override {
-        c_ = MakeChan<SysTimePoint>();
+        int buffer = buffer_ > 0 ? buffer_ : (t_->policy == TickPolicy::burst ? burstBuffer : 1);
+        c_ = MakeChan<SysTimePoint>(buffer);
+        tc_ = MakeChan<Tick>(buffer);
         t_->period = nanoseconds(period_);
         t_->when = When(period_);
         t_->status = _TimerStatus::noStatus;
-        t_->Do = [&]() {
-            c_->TryPush(Now());
-        };
-        t_->End = [&]() {
-            c_->Close();
-        };
+        if(t_->policy == TickPolicy::coalesce) {
+            t_->arg = tc_;
+            t_->Do = &Ticker::_FireTicks;
+        } else {
+            t_->arg = c_;
+            t_->Do = &Ticker::_FireTime;
+        }
+        t_->End = nullptr;     // a ticker only ends by Stop()
+    }
+
+    void _Close() override {
+        Timer<T, U>::_Close();
+        if(tc_ != nullptr) {
+            tc_->Close();
+        }
     }
+
+    static void _FireTime(_Timer* t, int64_t periods) {
+        int64_t missed = periods - 1;
+        if(static_cast<chan<SysTimePoint>*>(t->arg.get())->TryPush(Now()) != 1) {
+            ++missed;
+        }
+        if(missed > 0) {
+            t->missed += missed;
+        }
+    }
+
+    static void _FireTicks(_Timer* t, int64_t periods) {
+        t->pending += periods;
+        if(static_cast<chan<Tick>*>(t->arg.get())->TryPush(Tick { Now(), t->pending }) == 1) {
+            t->pending = 0;
+        }
+    }
+
+    SharedChan<Tick> tc_;
+
+    int buffer_;
 };
 
 } }
@@ -0,0 +1,233 @@
+#ifndef RTDSYNC_TRACE_H
+#define RTDSYNC_TRACE_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <deque>
+#include <string>
+#include <chrono>
+#include <ostream>
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+
+// Event tracing of channels, Select and timers, compiled in by defining RTDSYNC_TRACE,
+// or by the CMake option of the same name.
+// Every thread records into its own ring of the latest RTDSYNC_TRACE_BUFFER events without locking,
+// and DumpTrace() writes all rings as Chrome trace JSON, which chrome://tracing and Perfetto open.
+// Without it, the statements in RTDSYNC_TRACE_DO() are removed, and DumpTrace() writes an empty trace.
+#ifdef RTDSYNC_TRACE
+#define RTDSYNC_TRACE_DO(...) __VA_ARGS__
+#else
+#define RTDSYNC_TRACE_DO(...)
+#endif
+
+#ifndef RTDSYNC_TRACE_BUFFER
+#define RTDSYNC_TRACE_BUFFER 32768
+#endif
+
+// The number of rings kept before the ring of the earliest exited thread is reused.
+#ifndef RTDSYNC_TRACE_RINGS
+#define RTDSYNC_TRACE_RINGS 64
+#endif
+
+namespace rtd {
+
+enum class TraceEvent : uint8_t {
+    push,       // an element is pushed into the channel `obj`
+    pop,        // an element is popped from the channel `obj`
+    block,      // the thread blocks on the channel `obj`
+    wake,       // the thread wakes up from blocking on the channel `obj`
+    select,     // Select chooses the case `arg`
+    timer       // the timer `obj` runs, `arg` nanoseconds after its deadline
+};
+
+#ifdef RTDSYNC_TRACE
+
+// A ring of the latest events of one thread.
+// Only the owner thread writes, and the fields are relaxed atomics,
+// so a dump can read a ring while its thread keeps recording.
+struct _TraceBuffer {
+    struct Record {
+        std::atomic<int64_t> ts;
+        std::atomic<uintptr_t> obj;
+        std::atomic<int64_t> arg;   // the event in the low 8 bits
+    };
+
+    explicit _TraceBuffer(int t) : tid(t), head(0) {}
+
+    void Append(TraceEvent e, const void* o, int64_t a) {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        Record& r = records[h % RTDSYNC_TRACE_BUFFER];
+        r.ts.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count(), std::memory_order_relaxed);
+        r.obj.store(reinterpret_cast<uintptr_t>(o), std::memory_order_relaxed);
+        r.arg.store(a * 256 + static_cast<int64_t>(e), std::memory_order_relaxed);
+        head.store(h + 1, std::memory_order_release);
+    }
+
+    // The trace thread id, reassigned when the ring is reused by a new thread.
+    int tid;
+
+    // The number of events ever recorded.
+    std::atomic<uint64_t> head;
+
+    Record records[RTDSYNC_TRACE_BUFFER];
+};
+
+// All rings. The ring of an exited thread is kept for dumps,
+// until there are RTDSYNC_TRACE_RINGS rings and a new thread reuses it.
+class _TraceRegistry {
+    typedef std::lock_guard<std::mutex> guard;
+
+public:
+    _TraceRegistry() : enabled(true), nextTid_(1) {}
+
+    _TraceBuffer* Acquire() {
+        guard lc(mu_);
+        if(all_.size() >= RTDSYNC_TRACE_RINGS && !free_.empty()) {
+            _TraceBuffer* b = free_.front();
+            free_.pop_front();
+            b->tid = nextTid_++;
+            b->head = 0;
+            return b;
+        }
+        _TraceBuffer* b = new _TraceBuffer(nextTid_++);
+        all_.push_back(b);
+        return b;
+    }
+
+    void Release(_TraceBuffer* b) {
+        guard lc(mu_);
+        free_.push_back(b);
+    }
+
+    void Dump(std::ostream& out) {
+        guard lc(mu_);
+        out << "{\"traceEvents\":[";
+        bool first = true;
+        for(_TraceBuffer* b : all_) {
+            _DumpOne(out, b, &first);
+        }
+        out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+    }
+
+    std::atomic<bool> enabled;
+
+private:
+    void _DumpOne(std::ostream& out, _TraceBuffer* b, bool* first) {
+        static const char* names[] = {"push", "pop", "blocked", "blocked", "select", "timer"};
+        uint64_t h = b->head.load(std::memory_order_acquire);
+        uint64_t begin = h > RTDSYNC_TRACE_BUFFER ? h - RTDSYNC_TRACE_BUFFER : 0;
+        std::vector<std::pair<uint64_t, std::string>> events;
+        char buf[192];
+        for(uint64_t i = begin; i < h; i++) {
+            _TraceBuffer::Record& r = b->records[i % RTDSYNC_TRACE_BUFFER];
+            int64_t ts = r.ts.load(std::memory_order_relaxed);
+            uintptr_t obj = r.obj.load(std::memory_order_relaxed);
+            int64_t arg = r.arg.load(std::memory_order_relaxed);
+            TraceEvent e = static_cast<TraceEvent>(arg & 0xff);
+            arg >>= 8;
+            const char* ph = e == TraceEvent::block ? "B" : e == TraceEvent::wake ? "E" : "i";
+            std::snprintf(buf, sizeof(buf),
+                          "{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%lld.%03lld,\"pid\":1,\"tid\":%d%s"
+                          ",\"args\":{\"obj\":\"0x%llx\",\"arg\":%lld}}",
+                          names[static_cast<int>(e)], ph, (long long)(ts / 1000), (long long)(ts % 1000),
+                          b->tid, *ph == 'i' ? ",\"s\":\"t\"" : "",
+                          (unsigned long long)obj, (long long)arg);
+            events.push_back(std::make_pair(i, std::string(buf)));
+        }
+        // the oldest events may have been overwritten while copying
+        uint64_t valid = b->head.load(std::memory_order_acquire);
+        valid = valid > RTDSYNC_TRACE_BUFFER ? valid - RTDSYNC_TRACE_BUFFER : 0;
+        for(auto& ev : events) {
+            if(ev.first < valid) {
+                continue;
+            }
+            out << (*first ? "\n" : ",\n") << ev.second;
+            *first = false;
+        }
+    }
+
+    std::mutex mu_;
+
+    std::vector<_TraceBuffer*> all_;
+
+    std::deque<_TraceBuffer*> free_;
+
+    int nextTid_;
+};
+
+// It is never destroyed, so that threads exiting after main() can still release their rings.
+inline _TraceRegistry& _Traces() {
+    static _TraceRegistry* r = new _TraceRegistry();
+    return *r;
+}
+
+struct _TraceLocal {
+    _TraceBuffer* buf;
+
+    _TraceLocal() : buf(_Traces().Acquire()) {}
+
+    ~_TraceLocal() {
+        _Traces().Release(buf);
+    }
+};
+
+inline void _Trace(TraceEvent e, const void* obj, int64_t arg = 0) {
+    if(!_Traces().enabled.load(std::memory_order_relaxed)) {
+        return;
+    }
+    static thread_local _TraceLocal local;
+    local.buf->Append(e, obj, arg);
+}
+
+// Record a block event if `blocking`, and return it for the matching wake event.
+inline bool _TraceBlock(bool blocking, const void* obj) {
+    if(blocking) {
+        _Trace(TraceEvent::block, obj);
+    }
+    return blocking;
+}
+
+inline void _TraceWake(bool blocked, const void* obj) {
+    if(blocked) {
+        _Trace(TraceEvent::wake, obj);
+    }
+}
+
+// Pause or resume recording, it records from the start.
+inline void SetTracing(bool enabled) {
+    _Traces().enabled = enabled;
+}
+
+// Write the recorded events of all threads as Chrome trace JSON.
+inline void DumpTrace(std::ostream& out) {
+    _Traces().Dump(out);
+}
+
+#else
+
+inline void SetTracing(bool) {}
+
+// Write an empty Chrome trace, nothing is recorded without RTDSYNC_TRACE.
+inline void DumpTrace(std::ostream& out) {
+    out << "{\"traceEvents\":[]}\n";
+}
+
+#endif
+
+// Write the recorded events to a file. Return false if the file cannot be written.
+inline bool DumpTrace(const std::string& path) {
+    std::ofstream out(path);
+    if(!out) {
+        return false;
+    }
+    DumpTrace(out);
+    return static_cast<bool>(out);
+}
+
+}
+
+#endif //RTDSYNC_TRACE_H
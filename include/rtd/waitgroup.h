@@ -1,37 +1,61 @@
 #ifndef RTDSYNC_WAITGROUP_H
 #define RTDSYNC_WAITGROUP_H
 
+#include "sema.h"
+#include "pool.h"
+#include "select.h"
 #include <stdexcept>
-#include <condition_variable>
 #include <atomic>
-#include <iostream>
-#include <sstream>
+#include <mutex>
+#include <memory>
+#include <cstdint>
 
 namespace rtd {
 
+#if defined(__cpp_impl_coroutine)
+// The awaiter of a coroutine, defined in coro.h.
+class _WaitGroupAwaiter;
+#endif
+
+// A WaitGroup waits for a collection of tasks to finish.
+// The counter and the number of waiters are packed into one 64-bit atomic, as Golang does,
+// so Add() and Done() are a single atomic operation unless they release waiters.
 class WaitGroup {
 protected:
-    WaitGroup() : c_(0), w_(0) {}
+    WaitGroup() : state_(0), asyncWaiters_(0) {}
 
 public:
     friend std::shared_ptr<WaitGroup> MakeWaitGroup();
 
     // Add 1 before creating a async task.
+    // Calls with a positive delta that start when the counter is zero must happen before a Wait().
     void Add(int delta) {
-        if(c_ < 0) {
+        uint64_t state = state_.fetch_add(static_cast<uint64_t>(static_cast<int64_t>(delta)) << 32)
+                + (static_cast<uint64_t>(static_cast<int64_t>(delta)) << 32);
+        int32_t v = static_cast<int32_t>(state >> 32);  // counter
+        uint32_t w = static_cast<uint32_t>(state);      // waiters
+        if(v < 0) {
             throw std::logic_error("negative WaitGroup counter");
         }
-        c_ += delta;
-        std::stringstream ss;
-        ss << "c_:" << c_ << "   w_:" << w_ << std::endl;
-        std::cout << ss.str();
-        if(c_ > 0 || w_ == 0) {
+        if(w != 0 && delta > 0 && v == delta) {
+            throw std::logic_error("WaitGroup misuse: Add called concurrently with Wait");
+        }
+        if(v > 0) {
+            return;
+        }
+        if(asyncWaiters_.load() != 0) {
+            _WakeAsync();
+        }
+        if(w == 0) {
             return;
         }
 
-        for(; w_ != 0; w_--) {
-            cv_.notify_one();
+        // The counter reaches zero with waiters, nobody can change the state now.
+        if(state_.load() != state) {
+            throw std::logic_error("WaitGroup misuse: Add called concurrently with Wait");
         }
+        state_.store(0);
+        sema_.Release(w);
     }
 
     // Done() after complete a async task.
@@ -41,26 +65,98 @@ public:
 
     // Wait() can blocking, until all task being done.
     void Wait() {
-        if(c_ == 0) {
-            return;
+        uint64_t state = state_.load();
+        for(;;) {
+            int32_t v = static_cast<int32_t>(state >> 32);
+            if(v == 0) {
+                return;
+            }
+            if(state_.compare_exchange_weak(state, state + 1)) {   // register as a waiter
+                sema_.Acquire();
+                if(state_.load() != 0) {
+                    throw std::logic_error("WaitGroup is reused before previous Wait has returned");
+                }
+                return;
+            }
+        }
+    }
+
+#if defined(__cpp_impl_coroutine)
+    // Wait in a coroutine by `co_await wg->AsyncWait()`.
+    // The coroutine is parked on the WaitGroup instead of blocking its thread,
+    // until the counter reaches zero. Defined in coro.h.
+    _WaitGroupAwaiter AsyncWait();
+#endif
+
+    // The case of Select() that succeeds once the counter is zero.
+    SelectCase DoneCase() {
+        return SelectCase { [this]() -> int { return static_cast<int32_t>(state_.load() >> 32) == 0 ? 1 : 0; },
+                            this, &WaitGroup::_Watch, &WaitGroup::_Unwatch };
+    }
+
+    // Wait for a coroutine: return false if the counter is zero,
+    // or park `w` until the counter reaches zero and return true.
+    bool _Park(_Waiter* w) {
+        asyncWaiters_.fetch_add(1);     // seen by Add() once it reaches zero, or we see zero below
+        std::lock_guard<std::mutex> lc(mu_);
+        if(static_cast<int32_t>(state_.load() >> 32) == 0) {
+            asyncWaiters_.fetch_sub(1);
+            return false;
         }
-        w_ += 1;
-        std::unique_lock<std::mutex> lc(mu_);
-        cv_.wait(lc, [&]() { return c_ == 0; });
+        async_.Add(w);
+        return true;
     }
 
 private:
-    std::atomic<int> w_; // waiter
+    // Wake the parked coroutines and the watchers, the counter has reached zero.
+    void _WakeAsync() {
+        std::lock_guard<std::mutex> lc(mu_);
+        while(_Waiter* w = async_.PopFront()) {
+            asyncWaiters_.fetch_sub(1);
+            w->wake(w);
+        }
+        watchers_.WakeAll();
+    }
+
+    static void _Watch(void* g, _Waiter* w) {
+        WaitGroup* wg = static_cast<WaitGroup*>(g);
+        wg->asyncWaiters_.fetch_add(1);     // before Select() polls the counter, as in _Park()
+        std::lock_guard<std::mutex> lc(wg->mu_);
+        wg->watchers_.Add(w);
+    }
+
+    static void _Unwatch(void* g, _Waiter* w) {
+        WaitGroup* wg = static_cast<WaitGroup*>(g);
+        std::lock_guard<std::mutex> lc(wg->mu_);
+        wg->watchers_.Remove(w);
+        wg->asyncWaiters_.fetch_sub(1);
+    }
 
-    std::atomic<int> c_; // counter
+    // The high 32 bits are the counter, the low 32 bits are the number of waiters.
+    std::atomic<uint64_t> state_;
 
+    _Sema sema_;
+
+    // Guard `async_` and `watchers_`, and the check of the counter before parking on it.
     std::mutex mu_;
 
-    std::condition_variable cv_;
+    // The coroutines parked by AsyncWait(), unlike the threads they do not count in `state_`.
+    _WaitList async_;
+
+    // The Select() calls watching the counter.
+    _WaitList watchers_;
+
+    // The number of coroutines and watchers, parked or parking, for Add() to skip `mu_` when none.
+    std::atomic<uint32_t> asyncWaiters_;
+};
+
+// Make the constructor of WaitGroup accessible to std::allocate_shared.
+struct _SharedWaitGroup : public WaitGroup {
+    _SharedWaitGroup() : WaitGroup() {}
 };
 
-std::shared_ptr<WaitGroup> MakeWaitGroup() {
-    return std::shared_ptr<WaitGroup>(new WaitGroup());
+inline std::shared_ptr<WaitGroup> MakeWaitGroup() {
+    return std::allocate_shared<_SharedWaitGroup>(PoolAllocator<_SharedWaitGroup>());
 }
 
 }
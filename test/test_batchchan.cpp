@@ -0,0 +1,61 @@
+#include <rtd/batchchan.h>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <chrono>
+
+using namespace std;
+
+// Batches are flushed by size while the producer is fast, and by the linger deadline when it slows down.
+void TestBatchChan() {
+    auto ch = rtd::MakeBatchChan<int>(512, chrono::milliseconds(2));
+    thread producer([ch]() {
+        for(int i = 0; i < 2000; i++) {
+            ch->Push(i);
+        }
+        for(int i = 0; i < 5; i++) {
+            this_thread::sleep_for(chrono::milliseconds(5));
+            ch->Push(i);
+        }
+        ch->Close();
+    });
+
+    vector<int> batch;
+    while(ch->PopBatch(&batch)) {
+        cout << "batch: " << batch.size() << endl;
+    }
+    producer.join();
+}
+
+void BenchBatchChan(int producers, int n) {
+    auto ch = rtd::MakeBatchChan<long>(512, chrono::milliseconds(2));
+    auto start = chrono::steady_clock::now();
+    vector<thread> ts;
+    for(int i = 0; i < producers; i++) {
+        ts.emplace_back([ch, n]() {
+            for(long j = 0; j < n; j++) {
+                ch->Push(j);
+            }
+        });
+    }
+    thread closer([&]() {
+        for(auto& t : ts) {
+            t.join();
+        }
+        ch->Close();
+    });
+    vector<long> batch;
+    long total = 0, batches = 0;
+    while(ch->PopBatch(&batch)) {
+        total += batch.size();
+        batches++;
+    }
+    closer.join();
+    auto ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    cout << total << " elements in " << batches << " batches: " << (double)ns / total << " ns/elem" << endl;
+}
+
+int main() {
+    TestBatchChan();
+//    BenchBatchChan(4, 1000000);
+}
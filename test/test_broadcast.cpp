@@ -0,0 +1,77 @@
+#include <rtd/broadcast.h>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <chrono>
+
+using namespace std;
+
+// Every subscriber receives every element, and the publisher waits for the slowest one.
+void TestBroadcast() {
+    auto b = rtd::MakeBroadcast<int>(4);
+    vector<thread> ts;
+    for(int i = 0; i < 3; i++) {
+        auto s = b->Subscribe();
+        ts.emplace_back([s, i]() {
+            int v;
+            long sum = 0;
+            while(s->Recv(&v)) {
+                sum += v;
+                if(i == 0) {
+                    this_thread::sleep_for(chrono::microseconds(100));    // the slowest one
+                }
+            }
+            cout << "subscriber " << i << " sum: " << sum << endl;
+        });
+    }
+    for(int i = 1; i <= 1000; i++) {
+        b->Publish(i);
+    }
+    b->Close();
+    for(auto& t : ts) {
+        t.join();
+    }
+}
+
+// A slow subscriber skips the overwritten elements in the lag policy.
+void TestLag() {
+    auto b = rtd::MakeBroadcast<int>(8, rtd::BroadcastPolicy::lag);
+    auto s = b->Subscribe();
+    for(int i = 0; i < 20; i++) {
+        b->Publish(i);
+    }
+    b->Close();
+    int v;
+    while(s->Recv(&v)) {
+        cout << v << " ";
+    }
+    cout << endl << "dropped: " << s->Dropped() << endl;
+}
+
+void BenchBroadcast(int subscribers, int n) {
+    auto b = rtd::MakeBroadcast<long>(1024);
+    vector<thread> ts;
+    for(int i = 0; i < subscribers; i++) {
+        auto s = b->Subscribe();
+        ts.emplace_back([s]() {
+            long v;
+            while(s->Recv(&v)) {}
+        });
+    }
+    auto start = chrono::steady_clock::now();
+    for(long i = 0; i < n; i++) {
+        b->Publish(i);
+    }
+    b->Close();
+    for(auto& t : ts) {
+        t.join();
+    }
+    auto ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    cout << subscribers << " subscribers: " << (double)ns / n << " ns/msg" << endl;
+}
+
+int main() {
+    TestBroadcast();
+//    TestLag();
+//    BenchBroadcast(4, 1000000);
+}
@@ -119,7 +119,31 @@ void TestRandomProducer() {
 
 }
 
+// A lossy channel never blocks the producer, and counts the dropped elements.
+void TestOverflow() {
+    auto newest = rtd::MakeChan<int>(3, rtd::Overflow::dropNewest);
+    auto oldest = rtd::MakeChan<int>(3, rtd::Overflow::dropOldest);
+    for(int i = 0; i < 10; i++) {
+        newest->Push(i);
+        oldest->Push(i);
+    }
+    newest->Close();
+    oldest->Close();
+    int v;
+    cout << "dropNewest:";
+    while(newest->Pop(&v)) {
+        cout << " " << v;
+    }
+    cout << ", dropped: " << newest->Dropped() << endl;
+    cout << "dropOldest:";
+    while(oldest->Pop(&v)) {
+        cout << " " << v;
+    }
+    cout << ", dropped: " << oldest->Dropped() << endl;
+}
+
 int main() {
+//    TestOverflow();
 //    TestConsumerProducer();
 //    TestMultiChannelsWithSelect();
     TestRandomProducer();
@@ -0,0 +1,61 @@
+#include <rtd/context.h>
+#include <iostream>
+#include <thread>
+
+using namespace std;
+
+void TestCancelPop() {
+    auto ch = rtd::MakeChan<int>();
+    auto p = rtd::WithCancel(rtd::Background());
+    auto ctx = p.first;
+    auto cancel = p.second;
+
+    thread([cancel]() {
+        this_thread::sleep_for(chrono::seconds(1));
+        cancel();
+    }).detach();
+
+    int x;
+    int res = ch->Pop(&x, ctx);     // blocking until canceled
+    cout << "pop: " << res << ", canceled: " << (ctx->Err() == rtd::ContextErr::canceled) << endl;
+}
+
+void TestTimeout() {
+    auto ch = rtd::MakeChan<int>();
+    ch->Push(1);
+    auto p = rtd::WithTimeout(rtd::Background(), chrono::milliseconds(500));
+    auto ctx = p.first;
+
+    int res = ch->Push(2, ctx);     // channel filled
+    cout << "push: " << res << ", deadline exceeded: " << (ctx->Err() == rtd::ContextErr::deadlineExceeded) << endl;
+}
+
+void TestTree() {
+    auto parent = rtd::WithCancel(rtd::Background());
+    auto child = rtd::WithTimeout(parent.first, chrono::seconds(10));
+    auto ch1 = rtd::MakeChan<int>();
+    auto ch2 = rtd::MakeChan<int>();
+
+    thread([parent]() {
+        this_thread::sleep_for(chrono::milliseconds(500));
+        parent.second();
+    }).detach();
+
+    int x;
+    switch(rtd::Select(child.first, {
+        ch1->TryPopState(&x),
+        ch2->TryPopState(&x)
+    })) {
+        case -3:
+            cout << "child canceled by parent" << endl;
+            break;
+        default:
+            cout << "get data" << endl;
+    }
+}
+
+int main() {
+    TestCancelPop();
+//    TestTimeout();
+//    TestTree();
+}
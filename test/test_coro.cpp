@@ -0,0 +1,116 @@
+#include <rtd/coro.h>
+#include <iostream>
+#include <thread>
+#include <chrono>
+
+using namespace std;
+
+rtd::Task<void> Produce(rtd::SharedChan<int> ch, int n) {
+    for(int i = 0; i < n; i++) {
+        co_await ch->AsyncPush(i);
+    }
+    ch->Close();
+}
+
+rtd::Task<long> Consume(rtd::SharedChan<int> ch) {
+    long sum = 0;
+    int v;
+    while(co_await ch->AsyncPop(&v)) {
+        sum += v;
+    }
+    co_return sum;
+}
+
+// A producer coroutine and a consumer coroutine hand elements over a channel of one slot.
+void TestChan() {
+    auto ch = rtd::MakeChan<int>(1);
+    rtd::Spawn(Produce(ch, 1000));
+    cout << "sum: " << rtd::SyncWait(Consume(ch)) << endl;
+}
+
+rtd::Task<void> Worker(shared_ptr<rtd::WaitGroup> wg, int id) {
+    co_await rtd::time::Sleep(chrono::milliseconds(10 * id));
+    cout << "worker " << id << " done" << endl;
+    wg->Done();
+}
+
+rtd::Task<void> Wait(shared_ptr<rtd::WaitGroup> wg) {
+    for(int i = 1; i <= 3; i++) {
+        wg->Add(1);
+        rtd::Spawn(Worker(wg, i));
+    }
+    co_await wg->AsyncWait();
+    cout << "all workers done" << endl;
+}
+
+// Coroutines sleep on the timers heap, and another one waits for them on a WaitGroup.
+void TestSleepWaitGroup() {
+    rtd::SyncWait(Wait(rtd::MakeWaitGroup()));
+}
+
+rtd::Task<void> Choose(rtd::SharedChan<int> a, rtd::SharedChan<int> b) {
+    int x, y;
+    vector<rtd::SelectCase> cases = {a->PopCase(&x), b->PopCase(&y)};
+    while(1) {
+        int i = co_await rtd::AsyncSelect(cases);
+        if(i == -1) {
+            break;
+        }
+        cout << "select " << i << ": " << (i == 0 ? x : y) << endl;
+    }
+}
+
+// A coroutine is parked on two channels fed by threads, until both are closed.
+void TestSelect() {
+    auto a = rtd::MakeChan<int>(1);
+    auto b = rtd::MakeChan<int>(1);
+    thread ta([a]() {
+        for(int i = 0; i < 3; i++) {
+            this_thread::sleep_for(chrono::milliseconds(5));
+            a->Push(i);
+        }
+        a->Close();
+    });
+    thread tb([b]() {
+        for(int i = 100; i < 103; i++) {
+            this_thread::sleep_for(chrono::milliseconds(7));
+            b->Push(i);
+        }
+        b->Close();
+    });
+    rtd::SyncWait(Choose(a, b));
+    ta.join();
+    tb.join();
+}
+
+// Ping-pong between two coroutines, each round trip parks and resumes both of them.
+void BenchPingPong(int n) {
+    auto ping = rtd::MakeChan<int>(1);
+    auto pong = rtd::MakeChan<int>(1);
+    rtd::ThreadPool pool(2);
+    rtd::Spawn(pool, [](rtd::SharedChan<int> ping, rtd::SharedChan<int> pong) -> rtd::Task<void> {
+        int v;
+        while(co_await ping->AsyncPop(&v)) {
+            co_await pong->AsyncPush(v);
+        }
+        pong->Close();
+    }(ping, pong));
+    auto start = chrono::steady_clock::now();
+    rtd::SyncWait(pool, [](rtd::SharedChan<int> ping, rtd::SharedChan<int> pong, int n) -> rtd::Task<void> {
+        int v;
+        for(int i = 0; i < n; i++) {
+            co_await ping->AsyncPush(i);
+            co_await pong->AsyncPop(&v);
+        }
+        ping->Close();
+    }(ping, pong, n));
+    auto ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    cout << n << " round trips: " << (double)ns / n << " ns/round trip" << endl;
+}
+
+int main() {
+    TestChan();
+//    TestSleepWaitGroup();
+//    TestSelect();
+//    BenchPingPong(100000);
+}
@@ -0,0 +1,53 @@
+#include <rtd/errgroup.h>
+#include <iostream>
+#include <thread>
+#include <stdexcept>
+
+using namespace std;
+
+void TestFirstError() {
+    auto g = rtd::MakeErrGroup();
+    for(int i = 0; i < 5; i++) {
+        g->Go([=]() {
+            for(int j = 0; j < 10; j++) {
+                if(g->Canceled()) {
+                    cout << "task " << i << " canceled" << endl;
+                    return;
+                }
+                if(i == 2 && j == 3) {
+                    throw runtime_error("task 2 failed");
+                }
+                this_thread::sleep_for(chrono::milliseconds(100));
+            }
+            cout << "task " << i << " done" << endl;
+        });
+    }
+    auto err = g->Wait();
+    try {
+        if(err) {
+            rethrow_exception(err);
+        }
+    } catch(const exception& e) {
+        cout << "error: " << e.what() << endl;
+    }
+}
+
+void TestLimit() {
+    auto g = rtd::MakeErrGroup();
+    g->SetLimit(2);
+    atomic<int> running(0);
+    for(int i = 0; i < 10; i++) {
+        g->Go([&running, i]() {
+            int n = ++running;
+            cout << "task " << i << ", running: " << n << endl;
+            this_thread::sleep_for(chrono::milliseconds(200));
+            --running;
+        });
+    }
+    cout << "error: " << (g->Wait() != nullptr) << endl;
+}
+
+int main() {
+    TestFirstError();
+//    TestLimit();
+}
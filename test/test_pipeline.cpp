@@ -0,0 +1,93 @@
+#include <rtd/pipeline.h>
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <string>
+
+using namespace std;
+
+rtd::SharedChan<int> Source(int n) {
+    auto src = rtd::MakeChan<int>(128);
+    thread([src, n]() {
+        for(int i = 0; i < n; i++) {
+            src->Push(i);
+        }
+        src->Close();
+    }).detach();
+    return src;
+}
+
+// Square the numbers in 4 workers, keep the odd ones, and sum them.
+void TestPipeline() {
+    auto out = rtd::Pipeline<int>(Source(10000))
+            .Map([](int x) { return (long)x * x; }, 4)
+            .Filter([](long x) { return x % 2 == 1; })
+            .Merge();
+    long sum = 0, n = 0;
+    long v;
+    while(out->Pop(&v)) {
+        sum += v;
+        n++;
+    }
+    cout << n << " elements, sum: " << sum << endl;
+}
+
+// The workers sleep randomly, and the order of the source is kept by the reorder buffer.
+void TestOrdered() {
+    auto out = rtd::Pipeline<int>(Source(200))
+            .Batch(4)
+            .Ordered(8)
+            .Map([](int x) {
+                this_thread::sleep_for(chrono::microseconds(rand() % 500));
+                return to_string(x);
+            }, 8)
+            .Merge();
+    string v;
+    int expected = 0;
+    bool ordered = true;
+    while(out->Pop(&v)) {
+        ordered = ordered && v == to_string(expected++);
+    }
+    cout << expected << " elements, ordered: " << ordered << endl;
+}
+
+// Closing the output stops the whole pipeline.
+void TestStop() {
+    auto src = rtd::MakeChan<int>(16);
+    auto out = rtd::Pipeline<int>(src).Map([](int x) { return x + 1; }, 2).Merge();
+    thread producer([src]() {
+        int i = 0;
+        while(src->Push(i++)) {}
+        cout << "source stopped after " << i << " pushes" << endl;
+    });
+    int v;
+    for(int i = 0; i < 100; i++) {
+        out->Pop(&v);
+    }
+    out->Close();
+    this_thread::sleep_for(chrono::milliseconds(100));
+    src->Close();   // the pipeline does not close a channel it does not own, the producer does not wait on it
+    producer.join();
+}
+
+void BenchPipeline(int workers, int batch, int n) {
+    auto start = chrono::steady_clock::now();
+    auto out = rtd::Pipeline<int>(Source(n))
+            .Batch(batch)
+            .Map([](int x) { return x * 2; }, workers)
+            .Merge(1024);
+    int v, count = 0;
+    while(out->Pop(&v)) {
+        count++;
+    }
+    auto ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    cout << "workers " << workers << ", batch " << batch << ": " << (double)ns / count << " ns/elem" << endl;
+}
+
+int main() {
+    TestPipeline();
+    TestOrdered();
+//    TestStop();
+//    BenchPipeline(4, 1, 1000000);
+//    BenchPipeline(4, 64, 1000000);
+}
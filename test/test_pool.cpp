@@ -0,0 +1,93 @@
+#include <rtd/pool.h>
+#include <rtd/chan.h>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <list>
+#include <memory>
+
+using namespace std;
+
+struct Message {
+    char payload[256];
+    int len;
+};
+
+void TestPool() {
+    rtd::Pool<Message> pool;
+    Message* m1 = pool.Get();
+    m1->len = 10;
+    pool.Put(m1);
+    Message* m2 = pool.Get();   // reuse m1
+    cout << "reused: " << (m1 == m2) << endl;
+    pool.Put(m2);
+
+    pool.Sweep();   // m2 becomes a victim, and can still be taken
+    cout << "victim reused: " << (pool.Get() == m2) << endl;
+}
+
+// Pass messages from producers to consumers through a channel, taking them from a pool.
+void BenchPool(int threads, int n) {
+    rtd::Pool<Message> pool;
+    auto ch = rtd::MakeChan<Message*>(1024);
+    auto start = chrono::steady_clock::now();
+    vector<thread> ts;
+    for(int i = 0; i < threads; i++) {
+        ts.emplace_back([&]() {
+            for(int j = 0; j < n; j++) {
+                Message* m = pool.Get();
+                m->len = j;
+                ch->Push(m);
+            }
+        });
+        ts.emplace_back([&]() {
+            Message* m;
+            for(int j = 0; j < n; j++) {
+                ch->Pop(&m);
+                pool.Put(m);
+            }
+        });
+    }
+    for(auto& t : ts) {
+        t.join();
+    }
+    auto ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    cout << threads << " producers and consumers: " << (double)ns / ((double)threads * n) << " ns/msg" << endl;
+}
+
+// Push and pop the nodes of a list in every thread, each of them allocates and frees a node.
+template <typename Alloc>
+double BenchList(int threads, int n) {
+    auto start = chrono::steady_clock::now();
+    vector<thread> ts;
+    for(int i = 0; i < threads; i++) {
+        ts.emplace_back([n]() {
+            list<int, Alloc> l;
+            for(int j = 0; j < n; j++) {
+                l.push_back(j);
+                if(l.size() > 16) {
+                    l.pop_front();
+                }
+            }
+        });
+    }
+    for(auto& t : ts) {
+        t.join();
+    }
+    auto ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    return (double)ns / ((double)threads * n);
+}
+
+// Compare PoolAllocator with std::allocator on the nodes of a list.
+void BenchAllocator(int threads, int n) {
+    cout << threads << " threads, std::allocator: " << BenchList<allocator<int>>(threads, n) << " ns/op, "
+         << "PoolAllocator: " << BenchList<rtd::PoolAllocator<int>>(threads, n) << " ns/op" << endl;
+}
+
+int main() {
+    TestPool();
+//    BenchPool(4, 1000000);
+//    BenchAllocator(1, 10000000);
+//    BenchAllocator(8, 2000000);
+}
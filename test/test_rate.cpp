@@ -0,0 +1,59 @@
+#include <rtd/rate.h>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <chrono>
+
+using namespace std;
+
+void TestAllow() {
+    rtd::RateLimiter limiter(10, 5);    // 10 per second, up to 5 at once
+    int allowed = 0;
+    for(int i = 0; i < 10; i++) {
+        allowed += limiter.Allow();
+    }
+    cout << "allowed: " << allowed << endl;     // the burst
+    this_thread::sleep_for(chrono::milliseconds(200));
+    cout << "allowed after 200ms: " << limiter.Allow(2) << endl;
+}
+
+void TestWait() {
+    rtd::RateLimiter limiter(100, 1);
+    auto start = chrono::steady_clock::now();
+    for(int i = 0; i < 50; i++) {
+        limiter.Wait();
+    }
+    auto ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+    cout << "50 permits at 100/s: " << ms << " ms" << endl;
+
+    auto ctx = rtd::WithTimeout(rtd::Background(), chrono::milliseconds(100));
+    int got = 0;
+    while(limiter.Wait(1, ctx.first) == 1) {
+        got++;
+    }
+    cout << "permits within 100ms: " << got << endl;
+}
+
+void BenchAllow(int threads, int n) {
+    rtd::RateLimiter limiter(1e9, 1000000);
+    auto start = chrono::steady_clock::now();
+    vector<thread> ts;
+    for(int i = 0; i < threads; i++) {
+        ts.emplace_back([&]() {
+            for(int j = 0; j < n; j++) {
+                limiter.Allow();
+            }
+        });
+    }
+    for(auto& t : ts) {
+        t.join();
+    }
+    auto ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    cout << threads << " threads: " << (double)ns / n << " ns/op" << endl;
+}
+
+int main() {
+    TestAllow();
+//    TestWait();
+//    BenchAllow(4, 1000000);
+}
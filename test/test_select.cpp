@@ -0,0 +1,75 @@
+#include <rtd/context.h>
+#include <rtd/ringbuf.h>
+#include <rtd/waitgroup.h>
+#include <iostream>
+#include <thread>
+#include <chrono>
+
+using namespace std;
+
+// One Select parks on a channel, a RingBuffer, a timer and a WaitGroup, without polling.
+void TestSelectMix() {
+    auto ch = rtd::MakeChan<int>(1);
+    rtd::RingBuffer<int> rb(8);
+    auto wg = rtd::MakeWaitGroup();
+    rtd::time::Timer<int, milli> timer(chrono::milliseconds(50));
+    timer.Start();
+
+    wg->Add(1);
+    thread t([&]() {
+        this_thread::sleep_for(chrono::milliseconds(10));
+        ch->Push(1);
+        this_thread::sleep_for(chrono::milliseconds(10));
+        rb.Put(2);
+        this_thread::sleep_for(chrono::milliseconds(60));
+        wg->Done();
+    });
+
+    int c, r;
+    rtd::SysTimePoint tp;
+    for(int done = 0; done < 4;) {
+        switch(rtd::Select({ch->PopCase(&c), rb.GetCase(&r), timer.Case(&tp), wg->DoneCase()})) {
+            case 0: cout << "chan: " << c << endl; done++; break;
+            case 1: cout << "ringbuf: " << r << endl; done++; break;
+            case 2: cout << "timer fired" << endl; done++; break;
+            case 3: cout << "waitgroup done" << endl; done++; wg->Add(1); break;  // not ready any more
+            default: cout << "closed" << endl; done = 4;
+        }
+    }
+    t.join();
+}
+
+// A Select gives up when its context is done.
+void TestSelectContext() {
+    auto ch = rtd::MakeChan<int>(1);
+    auto ctx = rtd::WithTimeout(rtd::Background(), chrono::milliseconds(20));
+    int v;
+    cout << "select: " << rtd::Select(ctx.first, {ch->PopCase(&v)}) << endl;   // -3
+}
+
+// A blocking Select of cases parks, while the one of TryState functions polls.
+void BenchSelect(int n) {
+    auto a = rtd::MakeChan<int>(64);
+    auto b = rtd::MakeChan<int>(64);
+    thread t([&]() {
+        for(int i = 0; i < n; i++) {
+            (i % 2 ? a : b)->Push(i);
+        }
+        a->Close();
+        b->Close();
+    });
+    int x, y, count = 0;
+    auto start = chrono::steady_clock::now();
+    while(rtd::Select({a->PopCase(&x), b->PopCase(&y)}) >= 0) {
+        count++;
+    }
+    auto ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    t.join();
+    cout << count << " selects: " << (double)ns / count << " ns/select" << endl;
+}
+
+int main() {
+    TestSelectMix();
+    TestSelectContext();
+//    BenchSelect(1000000);
+}
@@ -0,0 +1,89 @@
+#include <rtd/semaphore.h>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <chrono>
+
+using namespace std;
+
+// A large request at the front of the queue is served before smaller ones arriving later.
+void TestFifo() {
+    rtd::Semaphore sem(10);
+    sem.Acquire(8);
+    thread big([&]() {
+        sem.Acquire(10);
+        cout << "big acquired 10" << endl;
+        sem.Release(10);
+    });
+    this_thread::sleep_for(chrono::milliseconds(10));
+    thread small([&]() {
+        sem.Acquire(2);     // there are 2 units, but the big one waits first
+        cout << "small acquired 2" << endl;
+        sem.Release(2);
+    });
+    this_thread::sleep_for(chrono::milliseconds(10));
+    cout << "try acquire 1: " << sem.TryAcquire(1) << endl;    // 0, somebody waits
+    sem.Release(8);
+    big.join();
+    small.join();
+    cout << "available: " << sem.Available() << endl;
+}
+
+// An Acquire gives up when its context is done, and the waiters behind it are served.
+void TestContext() {
+    rtd::Semaphore sem(4);
+    sem.Acquire(3);
+    auto ctx = rtd::WithTimeout(rtd::Background(), chrono::milliseconds(20));
+    thread t([&]() {
+        this_thread::sleep_for(chrono::milliseconds(5));
+        sem.Acquire(1);     // queued behind the request of 2
+        cout << "acquired 1 after the timeout" << endl;
+        sem.Release(1);
+    });
+    cout << "acquire 2: " << sem.Acquire(2, ctx.first) << endl;    // -3
+    t.join();
+    sem.Release(3);
+}
+
+// Bound the in-flight units of many threads, compared with a buffered channel used as a semaphore.
+void BenchSemaphore(int threads, int n) {
+    rtd::Semaphore sem(threads / 2);
+    auto start = chrono::steady_clock::now();
+    vector<thread> ts;
+    for(int i = 0; i < threads; i++) {
+        ts.emplace_back([&]() {
+            for(int j = 0; j < n; j++) {
+                sem.Acquire();
+                sem.Release();
+            }
+        });
+    }
+    for(auto& t : ts) {
+        t.join();
+    }
+    auto ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    cout << "semaphore: " << (double)ns / threads / n << " ns/op" << endl;
+
+    auto ch = rtd::MakeChan<int>(threads / 2);
+    start = chrono::steady_clock::now();
+    ts.clear();
+    for(int i = 0; i < threads; i++) {
+        ts.emplace_back([&]() {
+            for(int j = 0; j < n; j++) {
+                ch->Push(1);
+                ch->Pop(nullptr);
+            }
+        });
+    }
+    for(auto& t : ts) {
+        t.join();
+    }
+    ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    cout << "chan: " << (double)ns / threads / n << " ns/op" << endl;
+}
+
+int main() {
+    TestFifo();
+    TestContext();
+//    BenchSemaphore(8, 100000);
+}
@@ -0,0 +1,51 @@
+#include <rtd/stats.h>
+#include <rtd/chan.h>
+#include <rtd/ringbuf.h>
+#include <rtd/time.h>
+#include <iostream>
+#include <thread>
+#include <chrono>
+
+using namespace std;
+
+void PrintStats() {
+    for(const rtd::StatsEntry& e : rtd::SnapshotStats()) {
+        cout << e.kind << " " << hex << e.id << dec << endl;
+        for(const auto& c : e.counters) {
+            if(c.second != 0) {
+                cout << "    " << c.first << ": " << c.second << endl;
+            }
+        }
+    }
+}
+
+// Build with -DRTDSYNC_STATS to see the counters.
+void TestStats() {
+    auto ch = rtd::MakeChan<int>(8);
+    thread consumer([ch]() {
+        int v;
+        while(ch->Pop(&v)) {
+            this_thread::sleep_for(chrono::microseconds(10));     // a slow consumer, the channel fills up
+        }
+    });
+    for(int i = 0; i < 1000; i++) {
+        ch->Push(i);
+    }
+    ch->Close();
+    consumer.join();
+
+    rtd::RingBuffer<int> rb(16);
+    for(int i = 0; i < 10; i++) {
+        rb.Put(i);
+    }
+
+    rtd::time::Timer<int, milli> t(chrono::milliseconds(10));
+    t.Start();
+    t.Channel()->Pop(nullptr);
+
+    PrintStats();
+}
+
+int main() {
+    TestStats();
+}
@@ -3,6 +3,9 @@
 #include <rtd/time.h>
 #include <rtd/chan.h>
 #include <sstream>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#endif
 
 using namespace std;
 
@@ -113,6 +116,172 @@ void TestNonBlockingPush() {
 
 }
 
+void TestSlackTickers() {
+    rtd::time::SetClockSource(rtd::time::ClockSource::coarse);
+
+    vector<rtd::time::Ticker<long, ratio<1>>> tickers;
+    for(int i = 0; i < 1000; i++) {
+        tickers.emplace_back(std::chrono::seconds(1));
+        tickers.back().SetSlack(std::chrono::milliseconds(50)).Start();
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(3500));
+    int ticks = 0;
+    std::chrono::system_clock::time_point tp;
+    for(auto& t : tickers) {
+        while(t.Channel()->TryPop(&tp) == 1) {
+            ++ticks;
+        }
+        t.Stop();
+    }
+    cout << "ticks: " << ticks << endl;
+}
+
+#if defined(__linux__)
+void TestTimerFd() {
+    rtd::time::TimerFd tfd;
+    int ep = epoll_create1(0);
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = tfd.Fd();
+    epoll_ctl(ep, EPOLL_CTL_ADD, tfd.Fd(), &ev);
+
+    rtd::time::Ticker t1(std::chrono::milliseconds(500));
+    rtd::time::Timer t2(std::chrono::seconds(2));
+    t1.Start();
+    t2.Start();
+
+    std::chrono::system_clock::time_point tp;
+    while(!t2.isStop()) {
+        struct epoll_event events[8];
+        int n = epoll_wait(ep, events, 8, -1);
+        for(int i = 0; i < n; i++) {
+            if(events[i].data.fd == tfd.Fd()) {
+                tfd.ProcessExpired();
+            }
+        }
+        if(t1.Channel()->TryPop(&tp) == 1) {
+            cout << "ticker " << rtd::time::Ctime(tp) << endl;
+        }
+        if(t2.Channel()->TryPop(&tp) == 1) {
+            cout << "timer " << rtd::time::Ctime(tp) << endl;
+        }
+    }
+    t1.Stop();
+    close(ep);
+}
+#endif
+
+void TestRuntimeShutdown() {
+    TestTimer(1, "before shutdown");
+    rtd::time::Runtime::Get().Shutdown();
+    cout << "running: " << rtd::time::Runtime::Get().IsRunning() << endl;
+    TestTimer(1, "after shutdown");     // restarted by the timer
+    cout << "running: " << rtd::time::Runtime::Get().IsRunning() << endl;
+}
+
+void TestManualClock() {
+    rtd::time::ManualClock clock;
+    rtd::time::SetClock(&clock);
+
+    rtd::time::Ticker t1(std::chrono::seconds(1));
+    rtd::time::Timer t2(std::chrono::seconds(5));
+    t1.Start();
+    t2.Start();
+
+    int ticks = 0;
+    std::chrono::system_clock::time_point tp;
+    for(int i = 0; i < 10; i++) {
+        clock.Advance(std::chrono::seconds(1));
+        while(t1.Channel()->TryPop(&tp) == 1) {
+            ++ticks;
+        }
+    }
+    t1.Stop();
+    cout << "ticks: " << ticks << " (expect 10)" << endl;
+    cout << "timer stopped: " << t2.isStop() << " (expect 1)" << endl;
+
+    rtd::time::SetClockSource(rtd::time::ClockSource::steady);
+}
+
+void TestTickPolicy() {
+    rtd::time::ManualClock clock;
+    rtd::time::SetClock(&clock);
+
+    rtd::time::Ticker t1(std::chrono::seconds(1));
+    rtd::time::Ticker t2(std::chrono::seconds(1));
+    t1.Start();
+    t2.SetPolicy(rtd::time::TickPolicy::coalesce).Start();
+
+    clock.Advance(std::chrono::seconds(5));
+    cout << "skip missed: " << t1.Missed() << " (expect 4)" << endl;
+
+    rtd::time::Tick tick;
+    t2.Ticks()->Pop(&tick);
+    cout << "coalesce periods: " << tick.periods << " (expect 1)" << endl;
+    clock.Advance(std::chrono::seconds(1));
+    t2.Ticks()->Pop(&tick);
+    cout << "coalesce periods: " << tick.periods << " (expect 5)" << endl;
+
+    t1.Stop();
+    t2.Stop();
+    rtd::time::SetClockSource(rtd::time::ClockSource::steady);
+}
+
+#if defined(__linux__)
+// A late event loop runs 5 periods of two tickers in one pass, on the default channels.
+// The skip ticker delivers 1 tick, the burst one delivers all 5.
+void TestBurstCatchUp() {
+    rtd::time::TimerFd tfd;
+    rtd::time::Ticker skip(std::chrono::milliseconds(100));
+    rtd::time::Ticker burst(std::chrono::milliseconds(100));
+    skip.Start();
+    burst.SetPolicy(rtd::time::TickPolicy::burst).Start();
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(550));
+    tfd.ProcessExpired();
+
+    int skipTicks = 0, burstTicks = 0;
+    std::chrono::system_clock::time_point tp;
+    while(skip.Channel()->TryPop(&tp) == 1) {
+        ++skipTicks;
+    }
+    while(burst.Channel()->TryPop(&tp) == 1) {
+        ++burstTicks;
+    }
+    cout << "skip ticks: " << skipTicks << " (expect 1), missed: " << skip.Missed() << endl;
+    cout << "burst ticks: " << burstTicks << " (expect 5), missed: " << burst.Missed() << endl;
+    skip.Stop();
+    burst.Stop();
+}
+#endif
+
+// Spread `n` timers over an hour, and advance a virtual clock through it.
+void BenchHeapScaling(int n) {
+    rtd::time::ManualClock clock;
+    rtd::time::SetClock(&clock);
+
+    srand(time(0));
+    vector<rtd::time::Timer<long, milli>> timers;
+    timers.reserve(n);
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < n; i++) {
+        timers.emplace_back(std::chrono::milliseconds(rand() % 3600000));
+        timers.back().Start();
+    }
+    auto added = std::chrono::steady_clock::now();
+    for(int i = 0; i < 3600; i++) {
+        clock.Advance(std::chrono::seconds(1));
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    cout << n << " timers, add: "
+         << std::chrono::duration_cast<std::chrono::milliseconds>(added - start).count() << "ms, run: "
+         << std::chrono::duration_cast<std::chrono::milliseconds>(end - added).count() << "ms" << endl;
+
+    rtd::time::SetClockSource(rtd::time::ClockSource::steady);
+}
+
 int main() {
 
 //    TestTimer(3, "timer 1");
@@ -124,4 +293,15 @@ int main() {
 
 //    TestMultiTimers();
 
+//    TestSlackTickers();
+
+//    TestTimerFd();
+
+//    TestRuntimeShutdown();
+
+//    TestManualClock();
+//    TestTickPolicy();
+//    TestBurstCatchUp();
+//    BenchHeapScaling(1000000);
+
 }
\ No newline at end of file
@@ -0,0 +1,36 @@
+#include <rtd/trace.h>
+#include <rtd/chan.h>
+#include <rtd/time.h>
+#include <iostream>
+#include <thread>
+#include <chrono>
+
+using namespace std;
+
+// Build with -DRTDSYNC_TRACE, and open trace.json in chrome://tracing or ui.perfetto.dev.
+void TestTrace() {
+    auto ch1 = rtd::MakeChan<int>(2);
+    auto ch2 = rtd::MakeChan<int>(2);
+    thread producer([ch1, ch2]() {
+        for(int i = 0; i < 20; i++) {
+            (i % 2 == 0 ? ch1 : ch2)->Push(i);
+        }
+        ch1->Close();
+        ch2->Close();
+    });
+    int v;
+    while(rtd::Select({ch1->TryPopState(&v), ch2->TryPopState(&v)}) >= 0) {
+        this_thread::sleep_for(chrono::microseconds(100));
+    }
+    producer.join();
+
+    rtd::time::Timer<int, milli> t(chrono::milliseconds(1));
+    t.Start();
+    t.Channel()->Pop(nullptr);
+
+    cout << "dumped: " << rtd::DumpTrace("trace.json") << endl;
+}
+
+int main() {
+    TestTrace();
+}
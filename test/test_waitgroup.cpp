@@ -3,6 +3,8 @@
 #include <iostream>
 #include <thread>
 #include <ctime>
+#include <vector>
+#include <chrono>
 using namespace std;
 
 void TestWait() {
@@ -27,6 +29,32 @@ void TestWait() {
     }
 }
 
+// Add/Done at a high rate from several threads, while one thread waits.
+void BenchAddDone(int threads, int n) {
+    auto w = rtd::MakeWaitGroup();
+    auto start = chrono::steady_clock::now();
+    w->Add(threads);
+    vector<thread> ts;
+    for(int i = 0; i < threads; i++) {
+        ts.emplace_back([=]() {
+            for(int j = 0; j < n; j++) {
+                w->Add(1);
+                w->Done();
+            }
+            w->Done();
+        });
+    }
+    w->Wait();
+    auto end = chrono::steady_clock::now();
+    for(auto& t : ts) {
+        t.join();
+    }
+    auto ns = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+    cout << threads << " threads, " << n << " Add/Done each: "
+         << (double)ns / ((double)threads * n) << " ns/op" << endl;
+}
+
 int main() {
     TestWait();
+//    BenchAddDone(4, 1000000);
 }
\ No newline at end of file